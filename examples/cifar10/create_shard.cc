@@ -42,6 +42,7 @@
 using std::string;
 
 using singa::DataShard;
+using singa::DataShardBuilder;
 using singa::WriteProtoToBinaryFile;
 
 const int kCIFARSize = 32;
@@ -72,7 +73,9 @@ void create_shard(const string& input_folder, const string& output_folder) {
   for(int i=0;i<kCIFARImageNBytes;i++)
     mean.add_data(0.);
 
-  DataShard train_shard(output_folder+"/cifar10_train_shard",DataShard::kCreate);
+  // the builder writes to disk in a background thread
+  DataShardBuilder train_shard(output_folder+"/cifar10_train_shard",
+      DataShard::kCreate);
   LOG(INFO) << "Writing Training data";
   int count=0;
   for (int fileid = 0; fileid < kCIFARTrainBatches; ++fileid) {
@@ -96,7 +99,7 @@ void create_shard(const string& input_folder, const string& output_folder) {
       count+=1;
     }
   }
-  train_shard.Flush();
+  train_shard.Close();
   for(int i=0;i<kCIFARImageNBytes;i++)
     mean.set_data(i, mean.data(i)/count);
   WriteProtoToBinaryFile(mean, (output_folder+"/image_mean.bin").c_str());
@@ -0,0 +1,94 @@
+#!/usr/bin/env bash
+#
+#/**
+# * Copyright 2015 The Apache Software Foundation
+# *
+# * Licensed to the Apache Software Foundation (ASF) under one
+# * or more contributor license agreements.  See the NOTICE file
+# * distributed with this work for additional information
+# * regarding copyright ownership.  The ASF licenses this file
+# * to you under the Apache License, Version 2.0 (the
+# * "License"); you may not use this file except in compliance
+# * with the License.  You may obtain a copy of the License at
+# *
+# *     http://www.apache.org/licenses/LICENSE-2.0
+# *
+# * Unless required by applicable law or agreed to in writing, software
+# * distributed under the License is distributed on an "AS IS" BASIS,
+# * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# * See the License for the specific language governing permissions and
+# * limitations under the License.
+# */
+#
+# compare the training time of allreduce.conf (ring all-reduce among worker
+# groups) with that of the same model trained via one server group
+#
+
+usage="Usage: allreduce_vs_ps.sh [ -steps <train steps> ] [ num_procs ... ]\n
+        num_procs  : 2 to 16, one worker group per procs, default 2 4 8 16\n
+        -steps     : train steps of each job, default 200\n
+       ### NOTICE ###\n
+        start zookeeper (bin/zk-service.sh start) and list localhost in\n
+        conf/hostfile, all procs are launched by bin/singa-run.sh"
+
+steps=200
+if [ "$1" == "-steps" ]; then
+  steps=$2
+  shift 2
+fi
+nprocs_list=${@:-2 4 8 16}
+for n in $nprocs_list; do
+  if [ $n -lt 2 ] || [ $n -gt 16 ]; then
+    echo -e $usage
+    exit 1
+  fi
+done
+
+script_path=`readlink -f $0`
+script_dir=`dirname $script_path`
+singa_dir=`dirname \`dirname $script_dir\``
+out_dir=`mktemp -d`
+
+# write a job conf of $2 worker groups into $1, other args are cluster fields
+gen_conf() {
+  local conf=$1 n=$2
+  shift 2
+  sed -e '/^cluster {/,/^}/d' -e '/^#/d' \
+      -e "s/^name:.*/name: \"`basename $conf .conf`\"/" \
+      -e "s/^train_steps:.*/train_steps: $steps/" \
+      -e 's/^test_freq:.*/test_freq: 0/' \
+      $script_dir/allreduce.conf > $conf
+  echo "cluster {" >> $conf
+  echo "  nworker_groups: $n" >> $conf
+  echo "  nworkers_per_procs: 1" >> $conf
+  echo "  share_memory: false" >> $conf
+  for field in "$@"; do
+    echo "  $field" >> $conf
+  done
+  echo "  workspace: \"examples/mnist\"" >> $conf
+  echo "}" >> $conf
+}
+
+# run the job conf $1 and print its wall time in seconds
+run_job() {
+  local start=`date +%s.%N`
+  ./bin/singa-run.sh -conf $1 > ${1%.conf}.log 2>&1
+  local end=`date +%s.%N`
+  awk "BEGIN { printf \"%.1f\", $end - $start }"
+}
+
+cd $singa_dir
+report=`printf "%-6s %-13s %-10s %s" procs allreduce\(s\) server\(s\) \
+  server/allreduce`
+for n in $nprocs_list; do
+  gen_conf $out_dir/allreduce-$n.conf $n "nserver_groups: 0" "allreduce: true"
+  gen_conf $out_dir/server-$n.conf $n "nserver_groups: 1" \
+    "nservers_per_group: 1"
+  echo Running $steps steps with $n procs
+  t_ar=`run_job $out_dir/allreduce-$n.conf`
+  t_ps=`run_job $out_dir/server-$n.conf`
+  ratio=`awk "BEGIN { printf \"%.2f\", $t_ps / $t_ar }"`
+  report="$report\n`printf "%-6s %-13s %-10s %s" $n $t_ar $t_ps $ratio`"
+done
+echo -e "$report"
+echo Job confs and outputs are in $out_dir
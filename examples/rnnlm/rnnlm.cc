@@ -35,6 +35,7 @@ using mshadow::cpu;
 using mshadow::Shape;
 using mshadow::Shape1;
 using mshadow::Shape2;
+using mshadow::Shape3;
 using mshadow::Tensor;
 
 inline Tensor<cpu, 2> RTensor2(Blob<float>* blob) {
@@ -49,6 +50,25 @@ inline Tensor<cpu, 1> RTensor1(Blob<float>* blob) {
   return tensor;
 }
 
+/**
+ * View the blob as a [time, batch, dim] tensor.
+ */
+inline Tensor<cpu, 3> RTensor3(Blob<float>* blob) {
+  const vector<int>& shape = blob->shape();
+  Tensor<cpu, 3> tensor(blob->mutable_cpu_data(),
+      Shape3(shape[0], shape[1], blob->count() / shape[0] / shape[1]));
+  return tensor;
+}
+
+/**
+ * View the first len steps of a [time, batch, dim] tensor as a matrix, one
+ * row per (step, sequence).
+ */
+inline Tensor<cpu, 2> Steps(const Tensor<cpu, 3>& tensor, int len) {
+  return Tensor<cpu, 2>(tensor.dptr,
+      Shape2(len * tensor.shape[1], tensor.shape[0]));
+}
+
 
 /*******DataLayer**************/
 DataLayer::~DataLayer() {
@@ -64,26 +84,56 @@ void DataLayer::Setup(const LayerProto& conf, const vector<Layer*>& srclayers) {
                singa::DataShard::kRead);
   string key;
   max_window_ = conf.GetExtension(data_conf).max_window();
-  records_.resize(max_window_ + 1);  // resize to # of records in data layer
+  batchsize_ = conf.GetExtension(data_conf).batchsize();
+  bucket_size_ = conf.GetExtension(data_conf).bucket_size();
+  CHECK_LE(max_window_ + 1, shard_->Count());
+  // resize to # of records in data layer
+  records_.resize((max_window_ + 1) * batchsize_);
+  lengths_.resize(batchsize_);
   window_ = 0;
-  shard_->Next(&key, &records_[window_]);
+  shard_->Next(&key, &last_);
 }
 
-void DataLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
-  CHECK(records_.size() <= shard_->Count());
-  records_[0] = records_[window_];
-  window_ = max_window_;
+void DataLayer::ReadSequence(vector<singa::Record>* seq) {
+  seq->clear();
+  seq->push_back(last_);
   for (int i = 1; i <= max_window_; i++) {
     string key;
-    if (shard_->Next(&key, &records_[i])) {
-      if (records_[i].GetExtension(word).word_index() == 0) {
-        window_ = i;
-        break;
-      }
-    } else {
+    seq->push_back(singa::Record());
+    if (!shard_->Next(&key, &seq->back())) {
       shard_->SeekToFirst();
-      CHECK(shard_->Next(&key, &records_[i]));
+      CHECK(shard_->Next(&key, &seq->back()));
     }
+    if (seq->back().GetExtension(word).word_index() == 0)
+      break;
+  }
+  last_ = seq->back();
+}
+
+void DataLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
+  if (sequences_.empty()) {
+    vector<vector<singa::Record>> bucket(bucket_size_ * batchsize_);
+    for (auto& seq : bucket)
+      ReadSequence(&seq);
+    if (bucket_size_ > 1)
+      std::stable_sort(bucket.begin(), bucket.end(),
+          [](const vector<singa::Record>& a, const vector<singa::Record>& b) {
+            return a.size() < b.size();
+          });
+    for (auto& seq : bucket)
+      sequences_.push_back(std::move(seq));
+  }
+  window_ = 0;
+  for (int b = 0; b < batchsize_; b++) {
+    lengths_[b] = sequences_[b].size() - 1;
+    window_ = std::max(window_, lengths_[b]);
+  }
+  for (int b = 0; b < batchsize_; b++) {
+    const auto& seq = sequences_.front();
+    // pad with the last word, which is a valid input to the embedding layer
+    for (int t = 0; t <= window_; t++)
+      records_[t * batchsize_ + b] = seq[std::min<int>(t, seq.size() - 1)];
+    sequences_.pop_front();
   }
 }
 
@@ -92,20 +142,29 @@ void LabelLayer::Setup(const LayerProto& conf,
     const vector<Layer*>& srclayers) {
   RNNLayer::Setup(conf, srclayers);
   CHECK_EQ(srclayers.size(), 1);
-  int max_window = dynamic_cast<DataLayer*>(srclayers[0])->max_window();
-  data_.Reshape(vector<int>{max_window, 4});
+  auto datalayer = dynamic_cast<DataLayer*>(srclayers[0]);
+  data_.Reshape(vector<int>{datalayer->max_window(), datalayer->batchsize(),
+      5});
 }
 
 void LabelLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
-  const auto& records = dynamic_cast<DataLayer*>(srclayers[0])->records();
+  auto datalayer = dynamic_cast<DataLayer*>(srclayers[0]);
+  const auto& records = datalayer->records();
+  const auto& lengths = datalayer->lengths();
+  int batchsize = datalayer->batchsize();
   float *label = data_.mutable_cpu_data();
-  window_ = dynamic_cast<RNNLayer*>(srclayers[0])->window();
-  for (int i = 0; i < window_; i++) {
-    WordRecord wordrecord = records[i + 1].GetExtension(word);
-    label[4 * i + 0] = wordrecord.class_start();
-    label[4 * i + 1] = wordrecord.class_end();
-    label[4 * i + 2] = wordrecord.word_index();
-    label[4 * i + 3] = wordrecord.class_index();
+  window_ = datalayer->window();
+  for (int t = 0; t < window_; t++) {
+    for (int b = 0; b < batchsize; b++) {
+      WordRecord wordrecord =
+        records[(t + 1) * batchsize + b].GetExtension(word);
+      float* l = label + 5 * (t * batchsize + b);
+      l[0] = wordrecord.class_start();
+      l[1] = wordrecord.class_end();
+      l[2] = wordrecord.word_index();
+      l[3] = wordrecord.class_index();
+      l[4] = t < lengths[b] ? 1 : 0;
+    }
   }
 }
 
@@ -118,9 +177,10 @@ void EmbeddingLayer::Setup(const LayerProto& conf,
     const vector<Layer*>& srclayers) {
   RNNLayer::Setup(conf, srclayers);
   CHECK_EQ(srclayers.size(), 1);
-  int max_window = dynamic_cast<DataLayer*>(srclayers[0])->max_window();
+  auto datalayer = dynamic_cast<DataLayer*>(srclayers[0]);
   word_dim_ = conf.GetExtension(embedding_conf).word_dim();
-  data_.Reshape(vector<int>{max_window, word_dim_});
+  data_.Reshape(vector<int>{datalayer->max_window(), datalayer->batchsize(),
+      word_dim_});
   grad_.ReshapeLike(data_);
   vocab_size_ = conf.GetExtension(embedding_conf).vocab_size();
   embed_ = Param::Create(conf.param(0));
@@ -130,28 +190,29 @@ void EmbeddingLayer::Setup(const LayerProto& conf,
 void EmbeddingLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
   auto datalayer = dynamic_cast<DataLayer*>(srclayers[0]);
   window_ = datalayer->window();
-  auto records = datalayer->records();
-  auto words = RTensor2(&data_);
+  const auto& records = datalayer->records();
+  auto words = Steps(RTensor3(&data_), window_);
   auto embed = RTensor2(embed_->mutable_data());
 
-  for (int t = 0; t < window_; t++) {
-    int idx = static_cast<int>(records[t].GetExtension(word).word_index());
+  for (index_t i = 0; i < words.shape[1]; i++) {
+    int idx = static_cast<int>(records[i].GetExtension(word).word_index());
     CHECK_GE(idx, 0);
     CHECK_LT(idx, vocab_size_);
-    Copy(words[t], embed[idx]);
+    Copy(words[i], embed[idx]);
   }
 }
 
 void EmbeddingLayer::ComputeGradient(int flag,
     const vector<Layer*>& srclayers) {
-  auto grad = RTensor2(&grad_);
+  auto grad = Steps(RTensor3(&grad_), window_);
   auto gembed = RTensor2(embed_->mutable_grad());
   auto datalayer = dynamic_cast<DataLayer*>(srclayers[0]);
-  auto records = datalayer->records();
+  const auto& records = datalayer->records();
   gembed = 0;
-  for (int t = 0; t < window_; t++) {
-    int idx = static_cast<int>(records[t].GetExtension(word).word_index());
-    Copy(gembed[idx], grad[t]);
+  // accumulate, as one word may appear at multiple steps
+  for (index_t i = 0; i < grad.shape[1]; i++) {
+    int idx = static_cast<int>(records[i].GetExtension(word).word_index());
+    gembed[idx] += grad[i];
   }
 }
 /***********HiddenLayer**********/
@@ -163,10 +224,9 @@ void HiddenLayer::Setup(const LayerProto& conf,
     const vector<Layer*>& srclayers) {
   RNNLayer::Setup(conf, srclayers);
   CHECK_EQ(srclayers.size(), 1);
-  const auto& innerproductData = srclayers[0]->data(this);
   data_.ReshapeLike(srclayers[0]->data(this));
   grad_.ReshapeLike(srclayers[0]->grad(this));
-  int word_dim = data_.shape()[1];
+  int word_dim = data_.shape().back();
   weight_ = Param::Create(conf.param(0));
   weight_->Setup(std::vector<int>{word_dim, word_dim});
 }
@@ -174,8 +234,8 @@ void HiddenLayer::Setup(const LayerProto& conf,
 // hid[t] = sigmoid(hid[t-1] * W + src[t])
 void HiddenLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
   window_ = dynamic_cast<RNNLayer*>(srclayers[0])->window();
-  auto data = RTensor2(&data_);
-  auto src = RTensor2(srclayers[0]->mutable_data(this));
+  auto data = RTensor3(&data_);
+  auto src = RTensor3(srclayers[0]->mutable_data(this));
   auto weight = RTensor2(weight_->mutable_data());
   for (int t = 0; t < window_; t++) {  // Skip the 1st component
     if (t == 0) {
@@ -188,14 +248,16 @@ void HiddenLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
   }
 }
 
+// gradients of padded steps are 0, as they come from the masked loss and
+// padded steps only follow valid steps
 void HiddenLayer::ComputeGradient(int flag, const vector<Layer*>& srclayers) {
-  auto data = RTensor2(&data_);
-  auto grad = RTensor2(&grad_);
+  auto data = RTensor3(&data_);
+  auto grad = RTensor3(&grad_);
   auto weight = RTensor2(weight_->mutable_data());
   auto gweight = RTensor2(weight_->mutable_grad());
-  auto gsrc = RTensor2(srclayers[0]->mutable_grad(this));
+  auto gsrc = RTensor3(srclayers[0]->mutable_grad(this));
   gweight = 0;
-  TensorContainer<cpu, 1> tmp(Shape1(data_.shape()[1]));
+  TensorContainer<cpu, 2> tmp(Shape2(data.shape[1], data.shape[0]));
   // Check!!
   for (int t = window_ - 1; t >= 0; t--) {
     if (t < window_ - 1) {
@@ -204,7 +266,9 @@ void HiddenLayer::ComputeGradient(int flag, const vector<Layer*>& srclayers) {
     }
     grad[t] = expr::F<op::sigmoid_grad>(data[t])* grad[t];
   }
-  gweight = dot(data.Slice(0, window_-1).T(), grad.Slice(1, window_));
+  if (window_ > 1)
+    gweight = dot(Steps(data, window_ - 1).T(),
+        Steps(grad.Slice(1, window_), window_ - 1));
   Copy(gsrc, grad);
 }
 
@@ -219,7 +283,8 @@ void LossLayer::Setup(const LayerProto& conf, const vector<Layer*>& srclayers) {
   CHECK_EQ(srclayers.size(), 2);
   const auto& src = srclayers[0]->data(this);
   int max_window = src.shape()[0];
-  int vdim = src.count() / max_window;   // Dimension of input
+  int batchsize = src.shape()[1];
+  int vdim = src.count() / max_window / batchsize;   // Dimension of input
   int vocab_size = conf.GetExtension(loss_conf).vocab_size();
   int nclass = conf.GetExtension(loss_conf).nclass();
   word_weight_ = Param::Create(conf.param(0));
@@ -227,78 +292,85 @@ void LossLayer::Setup(const LayerProto& conf, const vector<Layer*>& srclayers) {
   class_weight_ = Param::Create(conf.param(1));
   class_weight_->Setup(vector<int>{nclass, vdim});
 
-  pword_.resize(max_window);
-  pclass_.Reshape(vector<int>{max_window, nclass});
+  pword_.resize(max_window * batchsize);
+  pclass_.Reshape(vector<int>{max_window * batchsize, nclass});
 }
 
 void LossLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
   window_ = dynamic_cast<RNNLayer*>(srclayers[0])->window();
-  auto pclass = RTensor2(&pclass_);
-  auto src = RTensor2(srclayers[0]->mutable_data(this));
+  auto src = Steps(RTensor3(srclayers[0]->mutable_data(this)), window_);
+  int nrows = src.shape[1];
+  auto pclass = RTensor2(&pclass_).Slice(0, nrows);
   auto word_weight = RTensor2(word_weight_->mutable_data());
   auto class_weight = RTensor2(class_weight_->mutable_data());
   const float * label = srclayers[1]->data(this).cpu_data();
 
-  float loss = 0.f, ppl = 0.f;
-  for (int t = 0; t < window_; t++) {
-    int start = static_cast<int>(label[t * 4 + 0]);
-    int end = static_cast<int>(label[t * 4 + 1]);
+  // class probabilities of all steps and sequences
+  pclass = dot(src, class_weight.T());
+  for (int i = 0; i < nrows; i++) {
+    if (label[i * 5 + 4] == 0)
+      continue;
+    int start = static_cast<int>(label[i * 5 + 0]);
+    int end = static_cast<int>(label[i * 5 + 1]);
 
     auto wordWeight = word_weight.Slice(start, end);
     CHECK_GT(end, start);
-    pword_[t].Reshape(std::vector<int>{end-start});
-    auto pword = RTensor1(&pword_[t]);
-    pword = dot(src[t], wordWeight.T());
+    pword_[i].Reshape(std::vector<int>{end-start});
+    auto pword = RTensor1(&pword_[i]);
+    pword = dot(src[i], wordWeight.T());
     Softmax(pword, pword);
 
-    pclass[t] = dot(src[t], class_weight.T());
-    Softmax(pclass[t], pclass[t]);
+    Softmax(pclass[i], pclass[i]);
 
-    int wid = static_cast<int>(label[t * 4 + 2]);
-    int cid = static_cast<int>(label[t * 4 + 3]);
+    int wid = static_cast<int>(label[i * 5 + 2]);
+    int cid = static_cast<int>(label[i * 5 + 3]);
     CHECK_GT(end, wid);
     CHECK_GE(wid, start);
-    loss_ += -log(std::max(pword[wid - start] * pclass[t][cid], FLT_MIN));
-    ppl_ += log10(std::max(pword[wid - start] * pclass[t][cid], FLT_MIN));
+    loss_ += -log(std::max(pword[wid - start] * pclass[i][cid], FLT_MIN));
+    ppl_ += log10(std::max(pword[wid - start] * pclass[i][cid], FLT_MIN));
+    num_++;
   }
-  num_ += window_;
 }
 
 void LossLayer::ComputeGradient(int flag, const vector<Layer*>& srclayers) {
-  auto pclass = RTensor2(&pclass_);
-  auto src = RTensor2(srclayers[0]->mutable_data(this));
-  auto gsrc = RTensor2(srclayers[0]->mutable_grad(this));
+  auto src = Steps(RTensor3(srclayers[0]->mutable_data(this)), window_);
+  auto gsrc = Steps(RTensor3(srclayers[0]->mutable_grad(this)), window_);
+  int nrows = src.shape[1];
+  auto pclass = RTensor2(&pclass_).Slice(0, nrows);
   auto word_weight = RTensor2(word_weight_->mutable_data());
   auto gword_weight = RTensor2(word_weight_->mutable_grad());
   auto class_weight = RTensor2(class_weight_->mutable_data());
   auto gclass_weight = RTensor2(class_weight_->mutable_grad());
   const float * label = srclayers[1]->data(this).cpu_data();
-  gclass_weight = 0;
   gword_weight = 0;
-  for (int t = 0; t < window_; t++) {
-    int start = static_cast<int>(label[t * 4 + 0]);
-    int end = static_cast<int>(label[t * 4 + 1]);
-    int wid = static_cast<int>(label[t * 4 + 2]);
-    int cid = static_cast<int>(label[t * 4 + 3]);
-    auto pword = RTensor1(&pword_[t]);
+  for (int i = 0; i < nrows; i++) {
+    if (label[i * 5 + 4] == 0) {
+      // padded step, no gradient
+      pclass[i] = 0;
+      gsrc[i] = 0;
+      continue;
+    }
+    int start = static_cast<int>(label[i * 5 + 0]);
+    int end = static_cast<int>(label[i * 5 + 1]);
+    int wid = static_cast<int>(label[i * 5 + 2]);
+    int cid = static_cast<int>(label[i * 5 + 3]);
+    auto pword = RTensor1(&pword_[i]);
     CHECK_GT(end, wid);
     CHECK_GE(wid, start);
 
     // gL/gclass_act
-    pclass[t][cid] -= 1.0;
+    pclass[i][cid] -= 1.0;
     // gL/gword_act
     pword[wid - start] -= 1.0;
 
     // gL/gword_weight
     gword_weight.Slice(start, end) += dot(pword.FlatTo2D().T(),
-                                          src[t].FlatTo2D());
-    // gL/gclass_weight
-    gclass_weight += dot(pclass[t].FlatTo2D().T(),
-                         src[t].FlatTo2D());
-
-    gsrc[t] = dot(pword, word_weight.Slice(start, end));
-    gsrc[t] += dot(pclass[t], class_weight);
+                                          src[i].FlatTo2D());
+    gsrc[i] = dot(pword, word_weight.Slice(start, end));
   }
+  // gL/gclass_weight and the class part of gL/gsrc for all rows
+  gclass_weight = dot(pclass.T(), src);
+  gsrc += dot(pclass, class_weight);
 }
 
 const std::string LossLayer::ToString(bool debug, int flag) {
@@ -22,6 +22,7 @@
 #ifndef EXAMPLES_RNNLM_RNNLM_H_
 #define EXAMPLES_RNNLM_RNNLM_H_
 
+#include <deque>
 #include <string>
 #include <vector>
 #include "./singa.h"
@@ -51,12 +52,20 @@ class RNNLayer : virtual public Layer {
   inline int window() { return window_; }
 
  protected:
-  //!< effect window size for BPTT
+  //!< effect window size for BPTT, i.e., the max length of the sequences
   int window_;
 };
 
 /**
- * Input layer that get read records from data shard
+ * Input layer that get read records from data shard.
+ *
+ * Each mini-batch consists of batchsize() word sequences, stored in records_
+ * in [time, batch] order, i.e., records_[t * batchsize() + b] is the t-th
+ * word of the b-th sequence, for t in [0, max_window]. Word t is the input
+ * of step t and word t+1 is its label. Sequences shorter than window() are
+ * padded with their last word; lengths() tells the valid steps. Sequences
+ * are read bucket_size mini-batches ahead and sorted by length to reduce
+ * padding.
  */
 class DataLayer : public RNNLayer, public singa::DataLayer {
  public:
@@ -66,16 +75,37 @@ class DataLayer : public RNNLayer, public singa::DataLayer {
   int max_window() const {
     return max_window_;
   }
+  /**
+   * @return num of valid steps of each sequence in the mini-batch
+   */
+  const vector<int>& lengths() const {
+    return lengths_;
+  }
 
  private:
-  int max_window_;
+  /**
+   * Read the next sequence, which ends at the end of a sentence or after
+   * max_window_ words. The first word is the last word of the previous
+   * sequence.
+   */
+  void ReadSequence(vector<singa::Record>* seq);
+
+  int max_window_, bucket_size_;
   singa::DataShard* shard_;
+  //!< last word of the previous sequence
+  singa::Record last_;
+  //!< sequences read ahead
+  std::deque<vector<singa::Record>> sequences_;
+  vector<int> lengths_;
 };
 
 
 /**
  * LabelLayer that read records_[1] to records_[window_] from DataLayer to
- * offer label information
+ * offer label information.
+ *
+ * The data blob is of shape [max_window, batchsize, 5], storing class start,
+ * class end, word index, class index and a mask which is 0 for padded steps.
  */
 class LabelLayer : public RNNLayer {
  public:
@@ -111,6 +141,9 @@ class EmbeddingLayer : public RNNLayer {
 
 /**
  * hid[t] = sigmoid(hid[t-1] * W + src[t])
+ *
+ * hid[t] and src[t] are matrices of shape [batchsize, dim], hence each step
+ * is a matrix multiplication for all sequences of the mini-batch.
  */
 class HiddenLayer : public RNNLayer {
  public:
@@ -133,6 +166,10 @@ class HiddenLayer : public RNNLayer {
  * p(word at t+1 is from class c) = softmax(src[t]*Wc)[c]
  * p(w|c) = softmax(src[t]*Ww[Start(c):End(c)])
  * p(word at t+1 is w)=p(word at t+1 is from class c)*p(w|c)
+ *
+ * The class probabilities of all steps and sequences are computed together
+ * by one matrix multiplication. Padded steps are excluded from the loss and
+ * the gradients.
  */
 class LossLayer : public RNNLayer {
  public:
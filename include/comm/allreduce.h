@@ -0,0 +1,84 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#ifndef SINGA_COMM_ALLREDUCE_H_
+#define SINGA_COMM_ALLREDUCE_H_
+
+#include <vector>
+#include "comm/socket.h"
+
+namespace singa {
+
+/**
+ * Chunked ring all-reduce (sum) of float buffers among the members of a
+ * ring, e.g., the workers with the same ID from all worker groups.
+ *
+ * The buffer is split into one chunk per member. In the reduce-scatter
+ * phase, every member passes one partial sum to its next member per round;
+ * after N - 1 rounds each member holds one fully reduced chunk, which is
+ * then passed around in the all-gather phase. Each member sends and receives
+ * 2 * (N - 1) / N of the buffer, independent of N.
+ *
+ * Chunks are sent as kAllreduce msgs addressed to the next member via the
+ * socket, e.g., an InprocDealer connected to the stub, which routes msgs to
+ * members in the same or other processes. The socket must receive only
+ * kAllreduce msgs from the previous member, which arrive in sending order.
+ */
+class RingAllreduce {
+ public:
+  /**
+   * @param socket for sending and receiving chunks, not owned
+   * @param rank position of this member in the ring
+   * @param addrs addr of every member, indexed by rank
+   */
+  RingAllreduce(SocketInterface* socket, int rank,
+      const std::vector<int>& addrs);
+  /**
+   * Replace data[0, n) with its sum over all members.
+   *
+   * All members must call it in the same order with the same n.
+   */
+  void Sum(float* data, int n);
+  inline int rank() const { return rank_; }
+  inline int size() const { return addrs_.size(); }
+
+ protected:
+  /**
+   * Send the k-th chunk to the next member.
+   */
+  void SendChunk(const float* data, int n, int k, int round);
+  /**
+   * Receive the k-th chunk from the previous member and add it into (or
+   * copy it over) the local chunk.
+   */
+  void ReceiveChunk(float* data, int n, int k, int round, bool add);
+
+ protected:
+  SocketInterface* socket_ = nullptr;
+  int rank_ = 0;
+  std::vector<int> addrs_;
+  //!< num of Sum() calls, used to check msgs are not mixed up
+  int ncalls_ = 0;
+};
+
+}  // namespace singa
+
+#endif  // SINGA_COMM_ALLREDUCE_H_
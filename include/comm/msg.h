@@ -25,7 +25,10 @@
 // TODO(wangwei): make it a compiler argument
 #define USE_ZMQ
 
+#include <stdint.h>
+#include <queue>
 #include <utility>
+#include <vector>
 #ifdef USE_ZMQ
 #include <czmq.h>
 #endif
@@ -78,6 +81,27 @@ inline int AddrType(int addr) {
   return addr & mask;
 }
 
+/**
+ * Layout of the header frame of a Msg sent over sockets.
+ *
+ * It is copied as raw bytes, hence both ends must have the same endianness,
+ * which holds for all machines of a SINGA cluster.
+ */
+struct MsgHeader {
+  uint8_t version;  //!< kMsgHeaderVersion of the sender
+  uint8_t reserved;
+  uint16_t type;
+  int32_t src;
+  int32_t dst;
+  int32_t trgt_val;
+  int32_t trgt_version;
+};
+static_assert(sizeof(MsgHeader) == 20, "MsgHeader must be packed");
+/**
+ * Bump it when the layout of MsgHeader changes.
+ */
+const uint8_t kMsgHeaderVersion = 1;
+
 /**
  * Msg used to transfer Param info (gradient or value), feature blob, etc
  * between workers, stubs and servers.
@@ -167,9 +191,27 @@ class Msg {
    *  Returns size of the parsed content.
    */
   int ParseFormatFrame(const char* format, ...);
+  /**
+   * Move the header and frames of msg to the end of this msg, without copying
+   * frame data. It is used to coalesce small msgs to the same dst into one.
+   *
+   * @param msg it is deleted and reset to nullptr
+   */
+  void AppendMsg(Msg** msg);
+  /**
+   * Unpack msgs appended by AppendMsg(). All frames are moved into the
+   * returned msgs, hence this msg becomes empty.
+   */
+  std::vector<Msg*> SplitMsgs();
 
 #ifdef USE_ZMQ
+  /**
+   * Take over the zmsg, whose first frame is a MsgHeader.
+   */
   void ParseFromZmsg(zmsg_t* msg);
+  /**
+   * Prepend a MsgHeader frame and release the frames to the returned zmsg.
+   */
   zmsg_t* DumpToZmsg();
 #endif
 
@@ -233,6 +275,41 @@ inline void DeleteMsg(Msg** msg) {
   *msg = nullptr;
 }
 
+/**
+ * Queue of msgs popped in the order of their priorities.
+ *
+ * Msgs with smaller priority values are popped first; msgs of the same
+ * priority are popped in the order they are pushed.
+ */
+class MsgQueue {
+ public:
+  inline void Push(Msg* msg, int priority) {
+    queue_.push(Entry{priority, seq_++, msg});
+  }
+  inline Msg* Pop() {
+    Msg* msg = queue_.top().msg;
+    queue_.pop();
+    return msg;
+  }
+  inline bool empty() const { return queue_.empty(); }
+  inline size_t size() const { return queue_.size(); }
+
+ protected:
+  struct Entry {
+    int priority;
+    uint64_t seq;
+    Msg* msg;
+    // std::priority_queue pops the largest entry
+    bool operator<(const Entry& other) const {
+      if (priority != other.priority)
+        return priority > other.priority;
+      return seq > other.seq;
+    }
+  };
+  std::priority_queue<Entry> queue_;
+  uint64_t seq_ = 0;
+};
+
 }  // namespace singa
 
 #endif  // SINGA_COMM_MSG_H_
@@ -0,0 +1,166 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+
+#ifndef SINGA_COMM_RING_H_
+#define SINGA_COMM_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace singa {
+
+/**
+ * Bounded lock-free queue with exactly one producer thread and one consumer
+ * thread.
+ *
+ * Head and tail live on separate cache lines and each side caches the other
+ * side's index, hence Push() and Pop() touch shared lines only when the cached
+ * index says the ring looks full (resp. empty).
+ */
+template <typename T>
+class SPSCRing {
+ public:
+  /**
+   * @param capacity max num of items, rounded up to a power of 2
+   */
+  explicit SPSCRing(int capacity) {
+    int size = 2;
+    while (size < capacity)
+      size <<= 1;
+    buf_.resize(size);
+    mask_ = size - 1;
+  }
+  /**
+   * Called only by the producer.
+   *
+   * @return false if the ring is full
+   */
+  bool Push(const T& item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ > mask_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ > mask_)
+        return false;
+    }
+    buf_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * Called only by the consumer.
+   *
+   * @return false if the ring is empty
+   */
+  bool Pop(T* item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_)
+        return false;
+    }
+    *item = buf_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * Safe to call from any thread, but the result may be stale.
+   */
+  bool empty() const {
+    return head_.load(std::memory_order_acquire)
+      == tail_.load(std::memory_order_acquire);
+  }
+  int capacity() const { return mask_ + 1; }
+
+ private:
+  static const int kCacheLine = 64;
+  std::vector<T> buf_;
+  size_t mask_ = 0;
+  alignas(kCacheLine) std::atomic<size_t> head_{0};
+  size_t tail_cache_ = 0;  //!< consumer's copy of tail_
+  alignas(kCacheLine) std::atomic<size_t> tail_{0};
+  size_t head_cache_ = 0;  //!< producer's copy of head_
+};
+
+/**
+ * Spin-then-block wake-up for the consumer of one or more SPSCRing.
+ *
+ * The consumer spins for a short while before parking on a condition
+ * variable; producers pay for a mutex and a notify only if the consumer is
+ * parked.
+ */
+class Doorbell {
+ public:
+  /**
+   * Called by producers after pushing an item.
+   */
+  void Ring() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_seq_cst)) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      cv_.notify_one();
+    }
+  }
+  /**
+   * Called by the consumer to wait until ready() returns true.
+   *
+   * @param ready predicate checking the rings
+   * @param timeout max num of milliseconds to wait; negative for no limit
+   * @return the last result of ready()
+   */
+  template <typename Pred>
+  bool Wait(Pred ready, int timeout = -1) {
+    for (int i = 0; i < kSpins; i++) {
+      if (ready())
+        return true;
+      if (i >= kSpins / 2)
+        std::this_thread::yield();
+    }
+    if (timeout == 0)
+      return ready();
+    std::unique_lock<std::mutex> lock(mtx_);
+    parked_.store(true, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ret;
+    if (timeout < 0) {
+      cv_.wait(lock, ready);
+      ret = true;
+    } else {
+      ret = cv_.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+    }
+    parked_.store(false, std::memory_order_relaxed);
+    return ret;
+  }
+
+ private:
+  static const int kSpins = 2000;
+  std::atomic<bool> parked_{false};
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
+
+}  // namespace singa
+
+#endif  // SINGA_COMM_RING_H_
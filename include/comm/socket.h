@@ -25,10 +25,14 @@
 #ifdef USE_ZMQ
 #include <czmq.h>
 #endif
+#include <atomic>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "comm/msg.h"
+#include "comm/ring.h"
 
 namespace singa {
 
@@ -164,6 +168,156 @@ class Router : public SocketInterface {
 #endif
 };
 
+/**
+ * Pair of rings between one InprocDealer and the InprocRouter it connects to.
+ *
+ * Both ends pass Msg pointers, hence nothing is serialized or copied. The
+ * channel is owned by the router.
+ */
+struct InprocChannel {
+  explicit InprocChannel(int capacity, bool learn)
+    : up(capacity), down(capacity), learn_addr(learn) {}
+  SPSCRing<Msg*> up;  //!< dealer -> router
+  SPSCRing<Msg*> down;  //!< router -> dealer
+  Doorbell bell;  //!< the dealer waits on it for msgs in down
+  //! msgs that did not fit into down, only accessed by the router thread
+  std::deque<Msg*> overflow;
+  //! set if overflow is not empty; the dealer then wakes up the router
+  //! after consuming msgs to let it refill down
+  std::atomic<bool> blocked{false};
+  //! whether the router maps the src of msgs from this channel to it
+  bool learn_addr;
+};
+
+/**
+ * Router for intra-process communication based on SPSCRing.
+ *
+ * Each connected InprocDealer owns one channel, whose up ring is consumed by
+ * the (single) thread calling Receive() and Send(). Like Router, it learns the
+ * channel of an address from the first msg received from that channel, and
+ * buffers msgs to addresses that have not connected yet.
+ */
+class InprocRouter : public SocketInterface {
+ public:
+  InprocRouter();
+  /**
+   * @param capacity size of the rings of each channel
+   */
+  explicit InprocRouter(int capacity);
+  ~InprocRouter() override;
+  /**
+   * Register this router under the endpoint, e.g., "inproc://router", for
+   * InprocDealer to connect.
+   *
+   * @return 1 for success; 0 if the endpoint is taken
+   */
+  int Bind(const std::string& endpoint);
+  /**
+   * Never blocks; msgs are queued if the dst ring is full.
+   */
+  int Send(Msg** msg) override;
+  /**
+   * Send to the dealer of the channel regardless of the msg dst, e.g., to
+   * dispatch msgs among threads that share one address. Never blocks.
+   */
+  int Send(Msg** msg, InprocChannel* channel);
+  Msg* Receive() override;
+  /**
+   * Receive with a timeout.
+   *
+   * @param timeout max num of milliseconds to wait; negative for no limit and
+   * 0 for returning immediately
+   * @return nullptr if no msg arrives before the timeout
+   */
+  Msg* Receive(int timeout);
+  void* InternalID() const override;
+  /**
+   * Create a channel for a dealer; called by InprocDealer::Connect() from any
+   * thread.
+   */
+  InprocChannel* AddChannel(bool learn_addr);
+  /**
+   * Wake up the thread blocked in Receive(); called by dealers after sending.
+   */
+  void Ring() { bell_.Ring(); }
+  /**
+   * @return the router bound to the endpoint, nullptr if not found
+   */
+  static InprocRouter* Lookup(const std::string& endpoint);
+
+ protected:
+  /**
+   * Pop one msg from any channel in round-robin order.
+   */
+  bool Poll(Msg** msg);
+  /**
+   * Move msgs from the overflow queues into the rings as space frees up.
+   */
+  void Flush();
+  /**
+   * Push to the down ring of the channel, or to its overflow queue.
+   */
+  void Deliver(InprocChannel* channel, Msg* msg);
+
+ protected:
+  int capacity_ = 1024;
+  std::string endpoint_;
+  //! guard channels_ which is appended by dealer threads
+  std::mutex mtx_;
+  std::vector<InprocChannel*> channels_;
+  std::atomic<int> nchannels_{0};
+  //! snapshot of channels_ used by the router thread
+  std::vector<InprocChannel*> local_;
+  size_t next_ = 0;
+  Doorbell bell_;
+  std::map<int, InprocChannel*> id2channel_;
+  std::map<int, std::vector<Msg*>> bufmsg_;
+  int nblocked_ = 0;  //!< num of channels having overflow msgs
+};
+
+/**
+ * Dealer for intra-process communication, connecting to an InprocRouter.
+ *
+ * Send() and Receive() of one dealer must be called by the same thread.
+ */
+class InprocDealer : public SocketInterface {
+ public:
+  InprocDealer();
+  /**
+   * @param id local dealer ID, see Dealer
+   */
+  explicit InprocDealer(int id);
+  /**
+   * Setup the channel with the router bound to the endpoint.
+   *
+   * @param endpoint e.g., kInprocRouterEndpoint
+   * @param learn_addr false if this dealer forwards msgs on behalf of other
+   * processes, hence the router should not send msgs to their src via it.
+   * @return 1 connection sets up successfully; 0 otherwise
+   */
+  int Connect(const std::string& endpoint, bool learn_addr = true);
+  /**
+   * Spins (yields) while the ring to the router is full.
+   */
+  int Send(Msg** msg) override;
+  Msg* Receive() override;
+  /**
+   * @see InprocRouter::Receive(int)
+   */
+  Msg* Receive(int timeout);
+  void* InternalID() const override;
+  /**
+   * @return the channel to this dealer, see InprocRouter::Send(Msg**,
+   * InprocChannel*)
+   */
+  inline InprocChannel* channel() const { return channel_; }
+
+ protected:
+  int id_ = -1;
+  InprocRouter* router_ = nullptr;
+  InprocChannel* channel_ = nullptr;
+};
+
 #ifdef USE_MPI
 // TODO(wangsheng): add intra-process communication using shared queue
 std::vector<SafeQueue*> MPIQueues;
@@ -25,7 +25,9 @@
 #include <vector>
 #include "proto/job.pb.h"
 #include "proto/singa.pb.h"
+#include "utils/codec.h"
 #include "utils/factory.h"
+#include "utils/group_sync.h"
 #include "utils/param.h"
 #include "utils/singleton.h"
 #include "utils/updater.h"
@@ -75,6 +77,14 @@ class Driver {
    * @param job_conf job configuration
    */
   void SetupForResume(JobProto* job_conf);
+  /**
+   * Assign Param slices to server groups (for syncing among groups) and to
+   * servers within one group (for updating). The partition is shared by the
+   * stub and the servers.
+   *
+   * @param[in] net training neural network.
+   */
+  void PartitionParams(NeuralNet* net);
   /**
    * Create server instances.
    *
@@ -153,6 +163,26 @@ class Driver {
    */
   template<typename Subclass, typename Type>
   int RegisterParamGenerator(const Type& type);
+  /**
+   * Register GradCodec subclasses for compressing gradients.
+   *
+   * @param type ID of the subclass. If called to register built-in subclasses,
+   * it is from CodecType; if called to register user-defined
+   * subclass, it is a string;
+   * @return 0 if success; otherwise -1.
+   */
+  template<typename Subclass, typename Type>
+  int RegisterGradCodec(const Type& type);
+  /**
+   * Register GroupSync subclasses for syncing Params between server groups.
+   *
+   * @param type ID of the subclass. If called to register built-in subclasses,
+   * it is from GroupSyncType; if called to register user-defined
+   * subclass, it is a string;
+   * @return 0 if success; otherwise -1.
+   */
+  template<typename Subclass, typename Type>
+  int RegisterGroupSync(const Type& type);
 
   /****************** Access function ********************/
   /**
@@ -170,6 +200,8 @@ class Driver {
   int job_id_;
   JobProto job_conf_;
   SingaProto singa_conf_;
+  //!< server group / server ID in charge of each Param slice
+  vector<int> slice2group_, slice2server_;
 };
 
 /************* Implementation of template functions*************************
@@ -221,6 +253,20 @@ int Driver::RegisterWorker(const Type& type) {
   return 1;
 }
 
+template<typename Subclass, typename Type>
+int Driver::RegisterGradCodec(const Type& type) {
+  auto factory = Singleton<Factory<singa::GradCodec>>::Instance();
+  factory->Register(type, CreateInstance(Subclass, GradCodec));
+  return 1;
+}
+
+template<typename Subclass, typename Type>
+int Driver::RegisterGroupSync(const Type& type) {
+  auto factory = Singleton<Factory<singa::GroupSync>>::Instance();
+  factory->Register(type, CreateInstance(Subclass, GroupSync));
+  return 1;
+}
+
 }  // namespace singa
 
 #endif  // SINGA_DRIVER_H_
@@ -22,10 +22,17 @@
 #ifndef SINGA_NEURALNET_INPUT_LAYER_H_
 #define SINGA_NEURALNET_INPUT_LAYER_H_
 
+#include <czmq.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
 #include <string>
 #include <vector>
 #include "neuralnet/layer.h"
 #include "utils/data_shard.h"
+#include "utils/tensor_shard.h"
+#include "utils/thread_pool.h"
 /**
  * \file this file includes the declarations of input layers that inherit the
  * base InputLayer to load input features.
@@ -60,10 +67,24 @@ class DataLayer: virtual public InputLayer {
   virtual const std::vector<Record>& records() const {
     return records_;
   }
+  /**
+   * Assign one part of the dataset to this layer. It takes effect only if
+   * the partition field of the DataProto is set, in which case the records
+   * are split into num disjoint parts and this layer reads the id-th part.
+   *
+   * @param id global ID of the part, e.g., derived from the worker group ID
+   * and the worker ID
+   * @param num total num of parts, i.e., readers of the dataset
+   */
+  inline void set_data_partition(int id, int num) {
+    part_id_ = id;
+    nparts_ = num;
+  }
 
  protected:
   int random_skip_;
   int batchsize_;
+  int part_id_ = 0, nparts_ = 1;
   Record sample_;
   std::vector<Record> records_;
 };
@@ -80,11 +101,112 @@ class ShardDataLayer : public DataLayer {
   void ComputeFeature(int flag, const vector<Layer*>& srclayers) override;
 
  private:
+  /**
+   * Read the next record of this layer's part, restarting from the first
+   * record of the part at the end.
+   */
+  void NextRecord(Record* record);
+
   DataShard* shard_;
+  //!< [start_, end_) is the range of records to read, end_ < 0 for all
+  int start_ = 0, end_ = -1;
+  //!< index of the next record
+  int cursor_ = 0;
+};
+
+/**
+ * Layer for loading mini-batches from a TensorShard.
+ *
+ * No Record is created. The data and label Blobs of each mini-batch point to
+ * the mmapped shard file directly, hence no ParserLayer is needed. The
+ * partial mini-batch at the end of the shard (or of this layer's part) is
+ * skipped.
+ */
+class TensorDataLayer : public DataLayer {
+ public:
+  ~TensorDataLayer();
+
+  void Setup(const LayerProto& proto, const vector<Layer*>& srclayers) override;
+  void ComputeFeature(int flag, const vector<Layer*>& srclayers) override;
+  /**
+   * @return the label Blob for LossLayer if the shard has labels, otherwise
+   * the data Blob.
+   */
+  const Blob<float>& data(const Layer* from) const override;
+
+ private:
+  TensorShard* shard_ = nullptr;
+  Blob<float> label_;
+  //!< [start_, end_) is the range of rows to read, end_ = 0 before the first
+  //!< mini-batch
+  int64_t start_ = 0, end_ = 0;
+  //!< index of the first row of the next mini-batch
+  int64_t cursor_ = 0;
+};
+
+/**
+ * Layer for consuming a stream of Records, e.g., from an online feature
+ * pipeline, without materializing them into a shard.
+ *
+ * The source is configured by StreamDataProto::endpoint:
+ * - a ZeroMQ endpoint (containing "://"), e.g., ipc:///tmp/feature for a Unix
+ *   domain socket or tcp://host:port. The layer pulls messages from a
+ *   ZMQ_PULL socket, each frame of which is a serialized Record.
+ * - otherwise the path of a named pipe (or file), which contains
+ *   [record_len record] tuples where record_len is of type uint32. The pipe
+ *   is reopened at EOF, i.e., when the writer closes it.
+ *
+ * A receiving thread buffers at most buffer_size records. When the buffer is
+ * full it stops receiving, which blocks the sender through the ZeroMQ high
+ * water mark or the pipe buffer (i.e., back-pressure).
+ */
+class StreamDataLayer : public DataLayer {
+ public:
+  ~StreamDataLayer();
+
+  void Setup(const LayerProto& proto, const vector<Layer*>& srclayers) override;
+  void ComputeFeature(int flag, const vector<Layer*>& srclayers) override;
+
+ private:
+  /**
+   * Loop of the receiving thread.
+   */
+  void Receive();
+  /**
+   * Parse one serialized record and push it into the buffer, blocking while
+   * the buffer is full.
+   *
+   * @return false if the layer is being destroyed
+   */
+  bool Push(const char* data, size_t size);
+  /**
+   * Read exactly size bytes from the pipe, waiting for data.
+   *
+   * @return false if the pipe is closed by the writer or the layer is being
+   * destroyed
+   */
+  bool ReadPipe(char* buf, size_t size);
+
+  std::string endpoint_;
+  size_t buffer_size_;
+  zsock_t* sock_ = nullptr;
+  int fd_ = -1;
+  std::deque<Record> buffer_;
+  bool stop_ = false;
+  std::mutex mutex_;
+  // consumers wait on data_cv_ for records, the receiver waits on space_cv_
+  std::condition_variable data_cv_, space_cv_;
+  std::thread thread_;
 };
 
 #ifdef USE_LMDB
 #include <lmdb.h>
+/**
+ * Layer for loading Record from LMDB, e.g., databases created by Caffe.
+ *
+ * Records of the next mini-batch are read by a prefetching thread while the
+ * current mini-batch is being processed.
+ */
 class LMDBDataLayer : public DataLayer {
  public:
   ~LMDBDataLayer();
@@ -92,23 +214,45 @@ class LMDBDataLayer : public DataLayer {
   void Setup(const LayerProto& proto, const vector<Layer*>& srclayers) override;
   void OpenLMDB(const std::string& path);
   void ComputeFeature(int flag, const vector<Layer*>& srclayers) override;
-  void ConvertCaffeDatumToRecord(const CaffeDatum& datum,
+  /**
+   * Convert the datum into the record. The buffers of the datum are moved
+   * into the record, hence the datum should not be used afterwards.
+   */
+  void ConvertCaffeDatumToRecord(CaffeDatum* datum,
                                  SingleLabelImageRecord* record);
 
  private:
+  /**
+   * Move the cursor to the next record, restarting from the first record at
+   * the end.
+   */
+  void NextRecord();
+  /**
+   * Read records from the cursor position into records.
+   */
+  void ReadRecords(std::vector<Record>* records);
+
   MDB_env* mdb_env_;
   MDB_dbi mdb_dbi_;
   MDB_txn* mdb_txn_;
-  MDB_cursor* mdb_cursor_;
+  MDB_cursor* mdb_cursor_ = nullptr;
   MDB_val mdb_key_, mdb_value_;
+  //!< records of the next mini-batch, filled by prefetch_thread_
+  std::vector<Record> prefetch_records_;
+  std::thread prefetch_thread_;
 };
 #endif
 
 /**
  * Base layer for parsing the input records into Blobs.
+ *
+ * Subclasses may parse records in parallel using the thread pool, whose size
+ * is configured by ParserProto::num_threads.
  */
 class ParserLayer : public InputLayer {
  public:
+  ~ParserLayer();
+  void Setup(const LayerProto& proto, const vector<Layer*>& srclayers) override;
   void ComputeFeature(int flag, const vector<Layer*>& srclayers) override;
   void ComputeGradient(int flag, const vector<Layer*>& srclayers) override {}
   ConnectionType dst_layer_connection() const override {
@@ -119,6 +263,9 @@ class ParserLayer : public InputLayer {
    */
   virtual void ParseRecords(int flag, const std::vector<Record>& records,
       Blob<float>* blob) = 0;
+
+ protected:
+  ThreadPool* pool_ = nullptr;
 };
 
 /**
@@ -153,11 +300,85 @@ class RGBImageLayer : public ParserLayer {
   void ParseRecords(int flag, const std::vector<Record>& records,
                     Blob<float>* blob) override;
 
- private:
+ protected:
+  /**
+   * Setup the shapes of the output and mean blobs, and the augmentation
+   * settings from RGBImageProto.
+   *
+   * @param batchsize num of images per mini-batch
+   * @param channels num of channels of the raw images
+   * @param height height of the raw images
+   * @param width width of the raw images
+   */
+  void SetupTransform(const LayerProto& proto, int batchsize, int channels,
+      int height, int width);
+  /**
+   * Parse one image into dst, called by ParseRecords() from the pool
+   * threads.
+   *
+   * @param tid ID of the pool thread, i.e., index of its random generator
+   * @param train true for the training phase
+   * @param image the image record
+   * @param dst buffer for the channels_ x croph_ x cropw_ output values
+   */
+  virtual void ParseImage(int tid, bool train,
+      const SingleLabelImageRecord& image, float* dst);
+  /**
+   * Crop, mirror, subtract mean and scale one image in a single pass, which
+   * reads only the pixels inside the crop window. The window is random for
+   * the training phase and is at the center otherwise.
+   *
+   * @param pixel raw pixels of the image in CHW order, nullptr if the image
+   * is stored in float values
+   * @param data float values of the image, used if pixel is nullptr
+   * @param height height of the raw image
+   * @param width width of the raw image
+   * \copydetails ParseImage()
+   */
+  void Transform(int tid, bool train, const uint8_t* pixel, const float* data,
+      int height, int width, float* dst);
+
   float scale_;
   int cropsize_;
   bool mirror_;
+  //!< shape of the output image
+  int channels_, croph_, cropw_;
+  bool has_mean_ = false;
+  //!< mean image of the raw image shape
   Blob<float> mean_;
+  //!< one random generator per thread of the pool
+  std::vector<std::mt19937> rngs_;
+};
+/**
+ * Derived from RGBImageLayer to parse SingleLabelImageRecord whose pixel
+ * field stores an encoded (i.e., compressed) image.
+ *
+ * Images are decoded, optionally resized and then augmented as in
+ * RGBImageLayer by the threads of the pool. JPEG and PNG images are supported
+ * if configured with --enable-jpeg and --enable-png respectively. Records that
+ * are not encoded are parsed as in RGBImageLayer.
+ */
+class ImageDecodeLayer : public RGBImageLayer {
+ public:
+  void Setup(const LayerProto& proto, const vector<Layer*>& srclayers) override;
+
+ protected:
+  void ParseImage(int tid, bool train, const SingleLabelImageRecord& image,
+      float* dst) override;
+  /**
+   * Decode (and resize) one image into pixels_[tid] in CHW order.
+   *
+   * @param tid ID of the pool thread, whose buffers are used
+   * @param buf encoded image
+   * @param[out] height height of the decoded image
+   * @param[out] width width of the decoded image
+   */
+  void Decode(int tid, const std::string& buf, int* height, int* width);
+
+  int resize_height_, resize_width_;
+  bool bgr_;
+  //!< per thread buffers for decoded, resized and CHW pixels
+  std::vector<std::vector<uint8_t>> decoded_, resized_, pixels_;
 };
 /**
  * Layer for prefetching data records and parsing them.
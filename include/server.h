@@ -22,24 +22,84 @@
 #ifndef SINGA_SERVER_H_
 #define SINGA_SERVER_H_
 
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
 #include <unordered_map>
 #include <vector>
+#include "comm/ring.h"
 #include "comm/socket.h"
 #include "proto/job.pb.h"
+#include "utils/codec.h"
+#include "utils/group_sync.h"
 #include "utils/param.h"
 #include "utils/updater.h"
 
 namespace singa {
 
+//!< capacity of the request queue of each update thread of a server
+const int kUpdateQueueSize = 1024;
+
+/**
+ * Lock-free queue of requests from the Server::Run() thread to one of its
+ * update threads.
+ */
+struct UpdateQueue {
+  explicit UpdateQueue(int capacity) : ring(capacity) {}
+  SPSCRing<Msg*> ring;
+  Doorbell bell;  //!< the update thread waits on it for requests
+};
+
+/**
+ * Progress of the senders of update requests on one slice, used in the stale
+ * synchronous parallel (SSP) mode.
+ */
+struct SliceClock {
+  /**
+   * Advance the clock of the sender of an update request and hold the
+   * request until Release() returns it.
+   *
+   * @param shares num of Param shares whose gradients the request carries
+   */
+  void Tick(Msg* request, int shares);
+  /**
+   * @param num_total num of Param shares updating the slice
+   * @return clock of the slowest sender, -1 if requests from some shares
+   * have not arrived yet
+   */
+  int Slowest(int num_total) const;
+  /**
+   * @return held requests whose senders may start their next step, i.e.,
+   * are at most staleness steps ahead of the given slice version
+   */
+  std::vector<Msg*> Release(int version, int staleness);
+
+  //!< sender addr -> its clock, i.e., the num of steps it has finished
+  std::map<int, int> clocks;
+  //!< total num of Param shares aggregated by the known senders
+  int num_shares = 0;
+  //!< update requests whose responses are held until the slowest sender
+  //!< catches up
+  std::vector<Msg*> waiting;
+};
+
  /* Repsond to worker's get/put/udpate request, and periodically syncing with
   * other servers.
   *
   * Normally, the Server creates a response message for each request which
-  * will be sent back to the one who issued the request. However, if the request
-  * are not processed successfully, the original message will be returned. The
-  * sever does not know the returned message is a response or the original
-  * message. It just sends it to the router. The router will decided to
-  * re-send the request to the server or send it to the worker.
+  * will be sent back to the one who issued the request. Requests that cannot
+  * be processed yet, e.g., get requests for a version that is not reached,
+  * are parked until the slice is put or updated.
+  *
+  * With ClusterProto::server_threads > 1, the Run() thread only receives
+  * requests and passes them to update threads by slice ID, hence all
+  * per-slice states are accessed by a single thread.
+  *
+  * With ClusterProto::server_checkpoint, a slice is copied when it is updated
+  * to a checkpoint step, and the copies are written by a checkpoint thread,
+  * hence neither workers nor updates wait for the disk.
   */
 class Server {
  public:
@@ -53,11 +113,46 @@ class Server {
   inline int id() const { return id_; }
 
  protected:
+  /**
+   * Dispatch one request to the handler of its type.
+   *
+   * @param[in, out] msg the request msg
+   * @param[out] replies msgs to send, e.g., responses and sync requests
+   */
+  void HandleRequest(Msg** msg, std::vector<Msg*>* replies);
+  /**
+   * Loop of one update thread, which handles requests on the slices
+   * dispatched to its queue and sends replies via its own dealer.
+   */
+  void RunUpdates(UpdateQueue* queue);
+  /**
+   * Pass a request to the update thread in charge of its slice.
+   */
+  void Dispatch(Msg* msg);
+  /**
+   * @return the updater of the thread in charge of the slice
+   */
+  inline Updater* SliceUpdater(int slice_id) const {
+    return updaters_.at(slice_id % nthreads_);
+  }
+  /**
+   * @return the codec of the thread in charge of the slice; nullptr if
+   * gradients are not compressed
+   */
+  inline GradCodec* SliceCodec(int slice_id) const {
+    return codecs_.size() ? codecs_.at(slice_id % nthreads_) : nullptr;
+  }
+  /**
+   * Handle requests parked on a slice, called after the slice is put or
+   * updated. Requests that are still not ready are parked again.
+   */
+  void HandlePendingRequests(int slice_id, std::vector<Msg*>* replies);
   /**
    * Process GET request.
    *
-   * @return the orignal message or a response message which contains the values
-   * of the Param with the request version.
+   * @return a response message which contains the values of the Param with
+   * the request version, or nullptr if the request is parked until the Param
+   * is updated to that version.
    */
   Msg* HandleGet(Msg** msg);
   /**
@@ -82,6 +177,16 @@ class Server {
    * @return the orignal message or response message
    */
   const std::vector<Msg*> HandleUpdate(Msg **msg);
+  /**
+   * Process Update request in the SSP mode, see ClusterProto::staleness.
+   *
+   * The gradients are applied immediately. The response, which lets the
+   * sender start its next step, is held while the sender would be more than
+   * staleness steps ahead of the slowest sender of this slice.
+   *
+   * @return responses released by this request
+   */
+  const std::vector<Msg*> HandleStaleUpdate(Msg **msg);
   /**
    * Process PUT request.
    *
@@ -92,40 +197,99 @@ class Server {
   /**
    * Handle sync request from other server groups.
    *
-   * It adds updates of Param (slice) from other server groups directly to
-   * local Param (slice). Currently, each Param (slice) has a master group,
-   * i.e., slice2group_[sliceid], which would receive such requests from all
-   * other server groups for the Param object.
+   * It merges the payload from other server groups into the local Param
+   * (slice) via GroupSync::Merge(). Currently, each Param (slice) has a
+   * master group, i.e., slice2group_[sliceid], which would receive such
+   * requests from all other server groups for the Param object. Requests
+   * are held until GroupSync::round_size() groups have sent one.
    *
-   * @param msg request msg containing the parameter updates
-   * @return response msg that contains the fresh parameter values.
+   * @param msg request msg containing the payload, e.g., parameter updates
+   * @return response msgs that contain the payloads from GroupSync::Merge(),
+   * empty if the round is not complete
    */
-  Msg* HandleSyncRequest(Msg** msg);
+  const std::vector<Msg*> HandleSyncRequest(Msg** msg);
+  /**
+   * Decode the payload of a sync request on a slice of n floats.
+   *
+   * @param decoded buffer for payloads compressed by a GradCodec
+   * @return the payload, which lives in the msg or in decoded
+   */
+  const float* ParseSyncPayload(Msg* msg, int slice_id, int n,
+      std::vector<float>* decoded);
   /**
    * Handle sync response.
    *
-   * The response msg includes the latest values of a Param object from the
-   * server group that maintainers this Param object.
-   * The local Param values are replaced with the addition result of local
-   * udpates since the sync request was sent and the received Param values.
+   * The response msg is parsed by GroupSync::ParseResponse(), which keeps
+   * the local updates since the sync request was sent.
    *
    * @param response message
    */
   void HandleSyncResponse(Msg** msg);
+  /**
+   * @return the first checkpoint step after the version, INT_MAX if none
+   */
+  int NextCheckpoint(int version) const;
+  /**
+   * Copy the values and updater states of a slice that has reached its next
+   * checkpoint step, and pass the copy to the checkpoint thread. Slices of
+   * other master groups are passed without values.
+   */
+  void SnapshotSlice(int slice_id);
+  /**
+   * Loop of the checkpoint thread. It writes one file per checkpoint step
+   * once all slices of this server have reached the step; the file has the
+   * master slices only and is empty if there are none.
+   */
+  void WriteCheckpoints();
 
  protected:
   int grp_id_ = -1;
   int id_ = -1;
-  Updater* updater_ = nullptr;
-  //!< map from slice ID to slice and deleted in the destructor
-  std::unordered_map<int, ParamEntry*> shard_;
+  //!< num of threads updating slices; 1 for the Run() thread itself
+  int nthreads_ = 1;
+  //!< one request queue per update thread if nthreads_ > 1
+  std::vector<UpdateQueue*> queues_;
+  //!< one updater per update thread
+  std::vector<Updater*> updaters_;
+  //!< compress sync msgs and decode compressed update msgs, one per thread
+  std::vector<GradCodec*> codecs_;
+  //!< slice ID -> slice (nullptr if not put yet), deleted in the destructor
+  std::vector<ParamEntry*> shard_;
+  //!< strategy for syncing slices with the master server group
+  GroupSync* group_sync_ = nullptr;
   std::vector<int> slice2group_, slice2server_;
   //!< num of updates from last sync with master server group for a param/slice
   std::vector<int> n_updates_;
   //!< num of sync requests that have not been responded
   std::vector<int> n_pending_sync_;
   std::vector<Blob<float>> last_sync_;
-  std::unordered_map<int, std::vector<Msg*>> buffer_requests_;
+  //!< state of master slices passed to GroupSync::Merge(), e.g., the center
+  //!< variable of EASGD
+  std::vector<Blob<float>> sync_center_;
+  //!< sync requests on master slices held until a round is complete
+  std::vector<std::vector<Msg*>> sync_requests_;
+  //!< compression error of sync msgs per slice, see GradCodec::Encode()
+  std::vector<Blob<float>> sync_residual_;
+  std::vector<std::vector<Msg*>> buffer_requests_;
+  //!< requests on slices that are not put or not updated to the requested
+  //!< version yet; they are handled again once the slice is put/updated
+  std::vector<std::vector<Msg*>> pending_requests_;
+  //!< per-slice clocks of senders in the SSP mode
+  std::vector<SliceClock> clocks_;
+  int checkpoint_after_ = 0, checkpoint_freq_ = 0;
+  //!< files to restore slices from, see JobProto::server_checkpoint_path
+  std::vector<std::string> checkpoint_paths_;
+  //!< slice ID -> restored values and states, applied when it is put
+  std::unordered_map<int, SliceSnapshot*> restored_;
+  //!< next checkpoint step per slice; INT_MAX if not checkpointed
+  std::vector<int> next_checkpoint_;
+  //!< num of slices updated by this server; a checkpoint file is written
+  //!< once all of them reach the step, but only master slices are saved
+  int num_checkpoint_slices_ = 0;
+  //!< snapshots to write by the checkpoint thread; nullptr to stop it
+  std::queue<SliceSnapshot*> snapshots_;
+  std::mutex snapshot_mutex_;
+  std::condition_variable snapshot_cv_;
 };
 
 }  // namespace singa
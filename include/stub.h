@@ -22,7 +22,9 @@
 #ifndef SINGA_STUB_H_
 #define SINGA_STUB_H_
 
+#include <atomic>
 #include <queue>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include <string>
@@ -33,6 +35,7 @@
 #include "utils/factory.h"
 #include "utils/param.h"
 #include "utils/singleton.h"
+#include "utils/thread_pool.h"
 #include "./server.h"
 #include "./worker.h"
 
@@ -69,6 +72,27 @@ class Stub {
    * @return the newly created socket
    */
   Dealer* CreateInterProcsDealer(int dst_procs);
+  /**
+   * Run by a separate thread to move msgs from other procs into router_, so
+   * that the Run() loop waits on a single InprocRouter.
+   */
+  void ForwardRemoteMsgs();
+  /**
+   * Loop of one handler thread, which handles msgs on the Params dispatched
+   * to its dealer (see Dispatch()). Generated msgs are sent back to router_,
+   * from which the Run() loop forwards them.
+   */
+  void HandleParamMsgs(InprocDealer* dealer);
+  /**
+   * @return the handler thread in charge of the ParamEntry of the msg
+   */
+  int Dispatch(const Msg* msg) const;
+  /**
+   * Handle one kGet/kPut/kUpdate request or kRGet/kRUpdate response.
+   *
+   * @return msgs to forward
+   */
+  const std::vector<Msg*> HandleParamMsg(Msg** msg);
   /**
    * Generate a request message to Get the parameter object.
    */
@@ -76,6 +100,10 @@ class Stub {
   void HandleGetResponse(ParamEntry* entry, Msg** msg);
   /**
    * Generate a request message to Update the parameter object.
+   *
+   * It is sent once all local shares of the ParamEntry have updated, which
+   * covers the workers of all local grps of a server grp if
+   * ClusterProto::aggregate_local_groups is set.
    */
   const std::vector<Msg*> HandleUpdateRequest(ParamEntry* entry, Msg** msg);
   /**
@@ -99,11 +127,49 @@ class Stub {
 
 
  protected:
-  Router *router_ = nullptr;
+  //! for msgs from workers and servers in this procs
+  InprocRouter *router_ = nullptr;
+  //! for msgs from other procs
+  Router *remote_router_ = nullptr;
+  std::atomic<bool> forwarding_{false};
+  //! compress gradients sent to servers in other procs, one per handler
+  //! thread as codecs keep scratch buffers
+  std::vector<GradCodec*> codecs_;
+  //! hash of (worker group, Param owner id) -> ParamEntry, see Hash()
+  std::unordered_map<int, ParamEntry*> shard_;
+  //! num of threads handling Param msgs; 1 for the Run() thread itself
+  int nhandlers_ = 1;
+  //! sum gradients of local shares slice by slice in parallel
+  ThreadPool* sum_pool_ = nullptr;
   std::string endpoint_;
   std::vector<int> slice2server_;
 };
 
+/**
+ * Create one ParamEntry per (worker group, Param owner) for the Params of
+ * local workers, keyed by their hash.
+ *
+ * @param grps_per_entry num of consecutive worker groups whose Params share
+ * one ParamEntry, see ClusterProto::aggregate_local_groups; 1 for none
+ */
+const std::unordered_map<int, ParamEntry*> CreateParamShard(
+    const std::vector<Worker*>& workers, int grps_per_entry);
+/**
+ * Sum the gradients of all local shares of a ParamEntry into its first
+ * share, averaged over ParamEntry::num_groups.
+ *
+ * @param pool threads summing slices in parallel
+ */
+void SumLocalGrads(ParamEntry* entry, ThreadPool* pool);
+/**
+ * Copy a slice received by the first share of an aggregated entry to the
+ * shares of other grps that do not share its memory.
+ *
+ * @param idx index of the slice in the first share
+ * @param version set to these shares if not negative
+ */
+void FanOutSlice(ParamEntry* entry, int idx, int version);
+
 }  // namespace singa
 
 #endif  // SINGA_STUB_H_
@@ -113,7 +113,23 @@ class Cluster {
   */
   inline bool share_memory() const { return cluster_.share_memory(); }
   inline int sync_freq() const { return cluster_.sync_freq(); }
+  inline int staleness() const { return cluster_.staleness(); }
+  inline const GroupSyncProto& group_sync() const {
+    return cluster_.group_sync();
+  }
+  inline bool allreduce() const { return cluster_.allreduce(); }
+  inline bool aggregate_local_groups() const {
+    return cluster_.aggregate_local_groups();
+  }
+  inline bool server_checkpoint() const {
+    return cluster_.server_checkpoint();
+  }
   inline int poll_time() const { return cluster_.poll_time(); }
+  inline const CodecProto& grad_codec() const { return cluster_.grad_codec(); }
+  inline int batch_msg_bytes() const { return cluster_.batch_msg_bytes(); }
+  inline int batch_msg_wait() const { return cluster_.batch_msg_wait(); }
+  inline int stub_threads() const { return cluster_.stub_threads(); }
+  inline int server_threads() const { return cluster_.server_threads(); }
   ClusterRuntime* runtime() const { return cluster_rt_; }
 
   /**
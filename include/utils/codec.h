@@ -0,0 +1,125 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#ifndef SINGA_UTILS_CODEC_H_
+#define SINGA_UTILS_CODEC_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "proto/job.pb.h"
+
+namespace singa {
+/**
+ * Base class for compressing gradients sent between processes.
+ *
+ * Encode() optionally applies error feedback: the caller keeps one residual
+ * buffer per Param slice, which is added to the next gradient of that slice
+ * and then replaced by the part lost in compression. Subclasses only
+ * implement Compress() and Decode().
+ *
+ * Codec instances keep scratch buffers, hence are not thread-safe.
+ */
+class GradCodec {
+ public:
+  /**
+   * Create a codec based on proto.type() (or user_type()).
+   */
+  static GradCodec* Create(const CodecProto& proto);
+
+  virtual ~GradCodec() {}
+  virtual void Init(const CodecProto& proto) { proto_ = proto; }
+  /**
+   * Compress grad[0, n) into buf.
+   *
+   * @param residual compression error of the last call for the same slice,
+   * updated in place; nullptr to disable error feedback
+   */
+  void Encode(const float* grad, int n, float* residual, std::string* buf);
+  /**
+   * Decompress the data and add alpha * values into dst[0, n).
+   */
+  virtual void Decode(const char* data, int nbytes, int n, float alpha,
+      float* dst) = 0;
+  /**
+   * @return the codec type recorded in msgs to check it against the receiver
+   */
+  inline int type() const { return proto_.type(); }
+  inline bool error_feedback() const { return proto_.error_feedback(); }
+
+ protected:
+  virtual void Compress(const float* val, int n, std::string* buf) = 0;
+
+ protected:
+  CodecProto proto_;
+  std::vector<float> val_;
+};
+
+/**
+ * Cast to IEEE 754 half precision, rounding to the nearest even.
+ */
+class FP16Codec : public GradCodec {
+ public:
+  void Decode(const char* data, int nbytes, int n, float alpha,
+      float* dst) override;
+
+ protected:
+  void Compress(const float* val, int n, std::string* buf) override;
+};
+
+/**
+ * Send the topk_ratio fraction of elements with the largest magnitude as
+ * (index, value) pairs.
+ */
+class TopKCodec : public GradCodec {
+ public:
+  void Decode(const char* data, int nbytes, int n, float alpha,
+      float* dst) override;
+
+ protected:
+  void Compress(const float* val, int n, std::string* buf) override;
+
+ private:
+  std::vector<int> idx_;
+};
+
+/**
+ * Send one sign bit per element; every element is decoded as +/- the mean
+ * magnitude of the slice.
+ */
+class SignCodec : public GradCodec {
+ public:
+  void Decode(const char* data, int nbytes, int n, float alpha,
+      float* dst) override;
+
+ protected:
+  void Compress(const float* val, int n, std::string* buf) override;
+};
+
+/**
+ * Conversion between float and IEEE 754 half precision.
+ */
+uint16_t FloatToHalf(float x);
+float HalfToFloat(uint16_t h);
+
+}  // namespace singa
+
+#endif  // SINGA_UTILS_CODEC_H_
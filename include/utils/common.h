@@ -143,6 +143,58 @@ void BackwardAvgPooling(const float* top, const int num, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int stride_h, const int stride_w,
     float* bottom);
+/**
+ * Convert uint8 pixels into float values, i.e.,
+ * dst[i] = (src[i] - mean[i]) * scale + bias.
+ *
+ * SSE2 instructions are used to convert 16 pixels per iteration if available.
+ *
+ * @param src raw pixels
+ * @param n num of pixels
+ * @param mean values to subtract from the pixels, nullptr for no subtraction
+ * @param scale multiplied on each pixel after subtracting the mean
+ * @param bias added on each pixel after scaling
+ * @param dst buffer for the n float values
+ */
+void PixelsToFloat(const uint8_t* src, int n, const float* mean, float scale,
+    float bias, float* dst);
+#ifdef USE_JPEG
+/**
+ * Decode a JPEG image into HWC pixels.
+ *
+ * @param buf the encoded image
+ * @param channels 1 for grayscale, 3 for RGB
+ * @param hwc resized to height*width*channels for the decoded pixels
+ * @return false if the image is corrupted
+ */
+bool DecodeJPEG(const std::string& buf, int channels, std::vector<uint8_t>* hwc,
+    int* height, int* width);
+#endif
+#ifdef USE_PNG
+/**
+ * Decode a PNG image into HWC pixels, alpha channels are dropped by
+ * compositing the image onto black.
+ *
+ * @param buf the encoded image
+ * @param channels 1 for grayscale, 3 for RGB
+ * @param hwc resized to height*width*channels for the decoded pixels
+ * @return false if the image is corrupted
+ */
+bool DecodePNG(const std::string& buf, int channels, std::vector<uint8_t>* hwc,
+    int* height, int* width);
+#endif
+/**
+ * Bilinear resize of HWC pixels, the pixel centers of the source and the
+ * destination image are aligned.
+ */
+void ResizeImage(const uint8_t* src, int height, int width, int channels,
+    int dst_height, int dst_width, uint8_t* dst);
+/**
+ * Reorder HWC pixels into CHW, optionally reversing the channels, e.g., from
+ * RGB to BGR.
+ */
+void HWCToCHW(const uint8_t* src, int height, int width, int channels,
+    bool bgr, uint8_t* dst);
 
 void ReadProtoFromTextFile(const char* filename, Message* proto);
 void WriteProtoToTextFile(const Message& proto, const char* filename);
@@ -23,12 +23,49 @@
 #define SINGA_UTILS_DATA_SHARD_H_
 
 #include <google/protobuf/message.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
+#include <mutex>
 #include <string>
-#include <unordered_set>
+#include <thread>
+#include <vector>
 
 namespace singa {
 
+/**
+ * @return 64-bit fingerprint of the key, i.e., its FNV-1a hash.
+ */
+uint64_t KeyFingerprint(const std::string& key);
+
+/**
+ * Set of 64-bit key fingerprints using open addressing.
+ *
+ * It takes 8 bytes per slot and keeps at least half of the slots empty,
+ * instead of storing the keys themselves. Two distinct keys are taken as
+ * duplicated with probability about n^2/2^65 for n keys.
+ */
+class KeySet {
+ public:
+  /**
+   * @param fp fingerprint of the key
+   * @return false if the fingerprint is in the set already.
+   */
+  bool Insert(uint64_t fp);
+  inline size_t size() const { return size_; }
+
+ private:
+  /**
+   * Double the num of slots and re-insert all fingerprints.
+   */
+  void Grow();
+
+  // 0 for empty slots, fingerprint 0 is stored as 1
+  std::vector<uint64_t> slots_;
+  size_t size_ = 0;
+};
+
 /**
  * Data shard stores training/validation/test tuples.
  * Every worker node should have a training shard (validation/test shard
@@ -110,6 +147,14 @@ class DataShard {
    * Used for repeated reading.
    */
   void SeekToFirst();
+  /**
+   * Move the read pointer to the tuple with the given index (starting from 0).
+   * Only the length fields are read to skip the preceding tuples.
+   *
+   * @param index index of the tuple to read next
+   * @return false if the shard has no more than index tuples
+   */
+  bool SeekTo(int index);
   /**
    * Flush buffered data to disk.
    * Used only for kCreate or kAppend.
@@ -141,7 +186,7 @@ class DataShard {
    * @param path shard path.
    * @return offset (end pos) of the last success written record.
    */
-  int PrepareForAppend(const std::string& path);
+  std::streamoff PrepareForAppend(const std::string& path);
   /**
    * Read data from disk if the current data in the buffer is not a full field.
    *
@@ -154,8 +199,8 @@ class DataShard {
   std::string path_ = "";
   // either ifstream or ofstream
   std::fstream fdat_;
-  // to avoid replicated record
-  std::unordered_set<std::string> keys_;
+  // fingerprints of inserted keys to avoid replicated record
+  KeySet keys_;
   // internal buffer
   char* buf_ = nullptr;
   // offset inside the buf_
@@ -166,6 +211,87 @@ class DataShard {
   int bufsize_ = 0;
 };
 
+/**
+ * Thread-safe builder of DataShard files, for creating large shards with
+ * multiple producer threads.
+ *
+ * Producers serialize records in their own threads and append the encoded
+ * tuples into a shared buffer. A full buffer is handed over to a writer
+ * thread, which writes it to disk in one large sequential write while the
+ * producers fill the other buffer. Duplicated keys are detected by their
+ * fingerprints, which are stored in KeySets sharded by fingerprint to reduce
+ * lock contention.
+ *
+ * The file format is the same as DataShard, hence the order of the tuples
+ * depends on the scheduling of the producers.
+ */
+class DataShardBuilder {
+ public:
+  /**
+   * @param folder shard folder (path excluding shard.dat)
+   * @param mode DataShard::kCreate or DataShard::kAppend
+   * @param capacity bytes of each of the two buffers, default is 100MB
+   */
+  DataShardBuilder(const std::string& folder, int mode);
+  DataShardBuilder(const std::string& folder, int mode, int capacity);
+  /**
+   * Close() the builder if it is not closed.
+   */
+  ~DataShardBuilder();
+  /**
+   * Append one tuple to the shard. Thread-safe.
+   *
+   * @param key e.g., image path
+   * @param tuple record to be serialized
+   * @return false if unsucess, e.g., inserted before
+   */
+  bool Insert(const std::string& key, const google::protobuf::Message& tuple);
+  /**
+   * Append one tuple to the shard. Thread-safe.
+   *
+   * @param key e.g., image path
+   * @param tuple serialized record
+   * @return false if unsucess, e.g., inserted before
+   */
+  bool Insert(const std::string& key, const std::string& tuple);
+  /**
+   * Write all buffered tuples and close the shard file. Insert() must not be
+   * called afterwards.
+   */
+  void Close();
+  /**
+   * @return num of tuples inserted by this builder
+   */
+  inline int count() const { return count_; }
+  /**
+   * @return path to shard file
+   */
+  inline const std::string& path() const { return path_; }
+
+ private:
+  /**
+   * Loop of the writer thread.
+   */
+  void Write();
+
+  static const int kNumKeyShards = 16;
+  std::string path_;
+  std::fstream fdat_;
+  KeySet keys_[kNumKeyShards];
+  std::mutex key_mutex_[kNumKeyShards];
+  // buffer being filled by producers and buffer being written by the writer
+  std::vector<char> fill_buf_, write_buf_;
+  size_t capacity_;
+  // write_buf_ is handed over and not written yet
+  bool writing_ = false;
+  bool closed_ = false;
+  std::mutex mutex_;
+  // the writer waits on full_cv_, producers wait on free_cv_
+  std::condition_variable full_cv_, free_cv_;
+  std::thread writer_;
+  std::atomic<int> count_;
+};
+
 }  // namespace singa
 
 #endif  // SINGA_UTILS_DATA_SHARD_H_
@@ -0,0 +1,158 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#ifndef SINGA_UTILS_GROUP_SYNC_H_
+#define SINGA_UTILS_GROUP_SYNC_H_
+
+#include <algorithm>
+#include <vector>
+#include "proto/job.pb.h"
+
+namespace singa {
+/**
+ * Base class of strategies for syncing the copies of a Param slice kept by
+ * different server groups.
+ *
+ * Every sync_freq updates, a server of a non-master group sends a payload
+ * generated by GenRequest() to the server of the master group (see
+ * Server::slice2group_). Once requests from round_size() groups are held,
+ * the master calls Merge() to fold them into its copy and replies to each
+ * with a payload parsed by ParseResponse(). All payloads have one float per
+ * element of the slice.
+ *
+ * Strategies keep no state besides the configuration; per-slice states are
+ * passed in by the servers, hence one instance can be shared by threads.
+ */
+class GroupSync {
+ public:
+  /**
+   * Create a strategy based on proto.type() (or user_type()).
+   *
+   * @param ngroups total num of server groups
+   */
+  static GroupSync* Create(const GroupSyncProto& proto, int ngroups);
+
+  virtual ~GroupSync() {}
+  virtual void Init(const GroupSyncProto& proto, int ngroups) {
+    proto_ = proto;
+    ngroups_ = ngroups;
+  }
+  /**
+   * Called by the non-master group.
+   *
+   * @param cur current values of the slice
+   * @param last values of the slice right after the last sync, updated to
+   * cur
+   * @param payload sent to the master group
+   */
+  virtual void GenRequest(int n, const float* cur, float* last,
+      float* payload) = 0;
+  /**
+   * @return num of requests, from distinct groups, merged in one round
+   */
+  virtual int round_size() const { return 1; }
+  /**
+   * Called by the master group once round_size() requests are held.
+   *
+   * @param payloads from GenRequest() of distinct groups
+   * @param master values of the slice in the master group, updated in place
+   * @param center state of the slice kept by the master group besides its
+   * values; initialized to the master values and only changed by Merge()
+   * @param responses one per payload, sent back to the group of the payload
+   */
+  virtual void Merge(int n, const std::vector<const float*>& payloads,
+      float* master, float* center,
+      const std::vector<float*>& responses) = 0;
+  /**
+   * Called by the non-master group; local updates done since the request
+   * was sent are kept.
+   *
+   * @param response from Merge()
+   * @param cur current values of the slice, updated in place
+   * @param last values of the slice right after the last sync, updated to
+   * cur
+   */
+  virtual void ParseResponse(int n, const float* response, float* cur,
+      float* last) = 0;
+  /**
+   * @return true if the request payload is a difference of values, which
+   * can be compressed like gradients (see GradCodec)
+   */
+  virtual bool diff_payload() const { return false; }
+
+ protected:
+  GroupSyncProto proto_;
+  int ngroups_ = 1;
+};
+
+/**
+ * Send the local changes since the last sync, which the master group adds to
+ * its values; the reply carries the master values (Downpour SGD).
+ */
+class DownpourSync : public GroupSync {
+ public:
+  void GenRequest(int n, const float* cur, float* last,
+      float* payload) override;
+  void Merge(int n, const std::vector<const float*>& payloads,
+      float* master, float* center,
+      const std::vector<float*>& responses) override;
+  void ParseResponse(int n, const float* response, float* cur,
+      float* last) override;
+  bool diff_payload() const override { return true; }
+};
+
+/**
+ * Elastic averaging SGD. The master group keeps the center variable besides
+ * its own copy. On each request, the sender's copy and then the master copy
+ * move towards the center by alpha times their difference, and the center
+ * moves by the same amounts the other way. The master copy uses alpha /
+ * (ngroups - 1) so that it moves as much per round as any other copy.
+ */
+class EASGDSync : public GroupSync {
+ public:
+  void GenRequest(int n, const float* cur, float* last,
+      float* payload) override;
+  void Merge(int n, const std::vector<const float*>& payloads,
+      float* master, float* center,
+      const std::vector<float*>& responses) override;
+  void ParseResponse(int n, const float* response, float* cur,
+      float* last) override;
+};
+
+/**
+ * Model averaging. Each round, the master group sets its values to the mean
+ * of the copies of all groups (its own included) and replies with the mean,
+ * which is parsed like DownpourSync.
+ */
+class AvgSync : public DownpourSync {
+ public:
+  int round_size() const override { return std::max(ngroups_ - 1, 1); }
+  void GenRequest(int n, const float* cur, float* last,
+      float* payload) override;
+  void Merge(int n, const std::vector<const float*>& payloads,
+      float* master, float* center,
+      const std::vector<float*>& responses) override;
+  bool diff_payload() const override { return false; }
+};
+
+}  // namespace singa
+
+#endif  // SINGA_UTILS_GROUP_SYNC_H_
@@ -22,13 +22,19 @@
 #ifndef SINGA_UTILS_PARAM_H_
 #define SINGA_UTILS_PARAM_H_
 
+#include <chrono>
+#include <climits>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "comm/msg.h"
+#include "proto/common.pb.h"
 #include "proto/job.pb.h"
 #include "utils/blob.h"
+#include "utils/codec.h"
 
 namespace singa {
 using std::vector;
@@ -73,6 +79,36 @@ class UniformSqrtFanInOutGen : public UniformGen {
   void Fill(Blob<float>* data) override;
 };
 
+/**
+ * Wake up threads waiting for new versions of Param values.
+ *
+ * Param objects sharing values share the same signal (see Param::ShareFrom),
+ * which is notified by Param::set_version().
+ */
+class VersionSignal {
+ public:
+  void Notify() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    cv_.notify_all();
+  }
+  /**
+   * Block until ready() returns true.
+   *
+   * @param timeout re-check ready() every this num of milliseconds, for
+   * conditions not covered by Notify()
+   */
+  template <typename Pred>
+  void Wait(Pred ready, int timeout) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!ready())
+      cv_.wait_for(lock, std::chrono::milliseconds(timeout));
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
+
 /**
  * Base paramter class.
  *
@@ -196,12 +232,24 @@ class Param {
    * @return the param version
    */
   inline int version() const { return data_->version(); }
-  inline void set_version(int v) { data_->set_version(v); }
+  inline void set_version(int v) {
+    data_->set_version(v);
+    signal_->Notify();
+  }
+  /**
+   * @return the signal notified when the version changes
+   */
+  inline VersionSignal* version_signal() const { return signal_.get(); }
   /**
    * @return the version of the parameter value local to a worker
    */
   inline int local_version() const { return local_version_; }
   inline void set_local_version(int v) { local_version_ = v; }
+  /**
+   * Set the codec for compressing gradients of update msgs sent to other
+   * procs and for decoding them on servers; not owned by this Param.
+   */
+  inline void set_codec(GradCodec* codec) { codec_ = codec; }
   inline const std::string& share_from() const { return proto_.share_from(); }
    /**
     * @return num of floats.
@@ -219,6 +267,11 @@ class Param {
    */
   inline int slice_start() const { return slice_start_; }
   inline int num_slices() const { return num_slices_; }
+  /**
+   * @return offset (in num of floats) of the idx-th slice
+   */
+  inline int slice_offset(int idx) const { return slice_offset_.at(idx); }
+  inline int slice_size(int idx) const { return slice_size_.at(idx); }
 
   /**
    * Below are message/request related functions.
@@ -349,6 +402,13 @@ class Param {
   std::shared_ptr<Blob<float>> data_ = nullptr;
   // gradient, history gradient of this parameter
   Blob<float> grad_, history_;
+  GradCodec* codec_ = nullptr;
+  // shared by Params sharing data_
+  std::shared_ptr<VersionSignal> signal_ = std::make_shared<VersionSignal>();
+  // compression error of each slice fed back into its next update msg
+  Blob<float> residual_;
+  // sum of decoded gradients on servers if no uncompressed one is received
+  Blob<float> decoded_grad_;
   ParamProto proto_;
 };
 
@@ -375,6 +435,9 @@ class ParamEntry {
   int num_update = 0;
   int num_local = 0;  //!< # local workers using the shared parameter
   int num_total = 0;  //!< # total workers using the shared parameter
+  //!< # worker groups whose shares are aggregated by the stub, see
+  //!< ClusterProto::aggregate_local_groups
+  int num_groups = 1;
   //!< Shares are deleted by neuralnet's destructor
   std::vector<Param*> shares;
 };
@@ -392,6 +455,62 @@ inline int SliceID(int param_trgt) {
   return param_trgt & mask;
 }
 
+/**
+ * Values and updater states (i.e., history) of a Param slice at one step,
+ * checkpointed by servers.
+ */
+struct SliceSnapshot {
+  int slice = 0;
+  int version = 0;
+  std::vector<float> data, history;
+};
+
+/**
+ * Write slices into a raw binary checkpoint file.
+ *
+ * The file has a header ("SGCK", format version, step, num of slices)
+ * followed by, for every slice, its ID, version, size, whether it has
+ * history, and the contiguous floats of its values and history. It is
+ * written into a temporary file and renamed, hence never seen half-written.
+ *
+ * @return true on success
+ */
+bool WriteSliceSnapshots(const std::string& path, int step,
+    const std::vector<SliceSnapshot*>& snapshots);
+/**
+ * Read slices from a file written by WriteSliceSnapshots().
+ *
+ * @param[out] snapshots appended with the slices, owned by the caller
+ * @return true on success
+ */
+bool ReadSliceSnapshots(const std::string& path,
+    std::vector<SliceSnapshot*>* snapshots);
+
+/**
+ * Priority of a msg in MsgQueue.
+ *
+ * Param IDs (and slice IDs) follow the order of layers in the net, hence msgs
+ * on Params of front layers, which are needed first by the forward pass of
+ * the next step, are served before those of back layers, although the latter
+ * are generated first by the backward pass. Other msgs, e.g., kStop, are
+ * served after all pending Param msgs.
+ */
+inline int MsgPriority(const Msg* msg) {
+  switch (msg->type()) {
+    case kGet:
+    case kRGet:
+    case kPut:
+    case kUpdate:
+    case kRUpdate:
+    case kSyncRequest:
+    case kSyncResponse:
+    case kBatch:
+      return msg->trgt_val();
+    default:
+      return INT_MAX;
+  }
+}
+
 }  // namespace singa
 
 #endif  // SINGA_UTILS_PARAM_H_
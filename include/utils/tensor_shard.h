@@ -0,0 +1,137 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+
+#ifndef SINGA_UTILS_TENSOR_SHARD_H_
+#define SINGA_UTILS_TENSOR_SHARD_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace singa {
+
+/**
+ * Header of the tensor shard file, i.e., folder/tensor.dat.
+ *
+ * A tensor shard stores a dense dataset whose records (rows) have the same
+ * fixed-size shape. The file consists of the header padded to
+ * kTensorShardDataOffset bytes, then the nrows rows stored contiguously, and
+ * finally nrows labels if has_label is set. Rows and labels are stored as
+ * float values, hence a mini-batch is just a slice of the file which can be
+ * used as Blob storage directly after mmap.
+ */
+struct TensorShardHeader {
+  char magic[8];
+  int32_t version;
+  //!< type of the values, only kTensorFloat is supported
+  int32_t dtype;
+  int32_t ndim;
+  //!< shape of one row
+  int32_t shape[8];
+  int32_t has_label;
+  int64_t nrows;
+};
+
+const char kTensorShardMagic[8] = "SGTENSR";
+const int kTensorShardVersion = 1;
+const int kTensorFloat = 0;
+//!< rows start at a page boundary to be mmap friendly
+const int kTensorShardDataOffset = 4096;
+
+/**
+ * Write a tensor shard row by row.
+ */
+class TensorShardWriter {
+ public:
+  /**
+   * @param folder shard folder (path excluding tensor.dat)
+   * @param shape shape of one row
+   * @param has_label true if every row has a label
+   */
+  TensorShardWriter(const std::string& folder, const std::vector<int>& shape,
+      bool has_label);
+  /**
+   * Close() the writer if it is not closed.
+   */
+  ~TensorShardWriter();
+  /**
+   * Append one row.
+   *
+   * @param row values of the row, whose size is the product of the shape
+   * @param label label of the row, ignored if has_label is false
+   */
+  void Append(const float* row, float label);
+  /**
+   * Write the labels and the final header, and close the file.
+   */
+  void Close();
+
+ private:
+  std::fstream fdat_;
+  TensorShardHeader header_;
+  std::vector<float> labels_;
+  int rowsize_;
+  bool closed_ = false;
+};
+
+/**
+ * Read-only view of a tensor shard through mmap.
+ */
+class TensorShard {
+ public:
+  /**
+   * @param folder shard folder (path excluding tensor.dat)
+   */
+  explicit TensorShard(const std::string& folder);
+  ~TensorShard();
+  /**
+   * @return pointer to the first value of the index-th row
+   */
+  inline float* row(int64_t index) const { return rows_ + index * rowsize_; }
+  /**
+   * @return pointer to the label of the index-th row, nullptr if no labels
+   */
+  inline float* label(int64_t index) const {
+    return labels_ == nullptr ? nullptr : labels_ + index;
+  }
+  inline int64_t nrows() const { return header_.nrows; }
+  inline int rowsize() const { return rowsize_; }
+  inline bool has_label() const { return header_.has_label != 0; }
+  /**
+   * @return shape of one row
+   */
+  const std::vector<int> shape() const;
+
+ private:
+  TensorShardHeader header_;
+  // the mmapped file
+  char* addr_ = nullptr;
+  size_t length_ = 0;
+  float* rows_ = nullptr;
+  float* labels_ = nullptr;
+  int rowsize_ = 0;
+};
+
+}  // namespace singa
+
+#endif  // SINGA_UTILS_TENSOR_SHARD_H_
@@ -0,0 +1,79 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+
+#ifndef SINGA_UTILS_THREAD_POOL_H_
+#define SINGA_UTILS_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace singa {
+/**
+ * A fixed-size pool of threads for data parallel loops, e.g., parsing the
+ * records of one mini-batch.
+ *
+ * The thread calling ParallelFor() runs one part of the loop itself, hence
+ * only size() - 1 threads are launched and a pool of size 1 runs everything
+ * in the calling thread.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @param nthreads total num of threads, including the calling thread
+   */
+  explicit ThreadPool(int nthreads);
+  ~ThreadPool();
+  /**
+   * Split [0, n) into at most size() contiguous ranges and run
+   * fn(tid, start, end) for each range in parallel, where tid is in
+   * [0, size()). It returns after all ranges are processed.
+   *
+   * @param n total num of items
+   * @param fn function to process items in [start, end)
+   */
+  void ParallelFor(int n, const std::function<void(int, int, int)>& fn);
+  /**
+   * @return total num of threads, including the calling thread
+   */
+  inline int size() const { return nthreads_; }
+
+ private:
+  /**
+   * Loop of the launched threads, which run tasks from the queue.
+   */
+  void Run();
+
+  int nthreads_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_cv_, done_cv_;
+};
+
+}  // namespace singa
+
+#endif  // SINGA_UTILS_THREAD_POOL_H_
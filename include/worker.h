@@ -24,13 +24,15 @@
 
 #include <string>
 #include <vector>
+#include "comm/allreduce.h"
 #include "comm/socket.h"
 #include "neuralnet/neuralnet.h"
 #include "proto/job.pb.h"
+#include "utils/updater.h"
 
 namespace singa {
 
-//!< sleep 5 milliseconds if the Param is not updated to the expected version
+//!< milliseconds between re-checks while waiting for a new Param version
 const int kCollectSleepTime = 5;
 /**
  * The Worker class which runs the training algorithm.
@@ -171,6 +173,9 @@ class Worker {
   /**
    * Update Param.
    *
+   * Send an update request to the stub, or in the all-reduce mode, sum the
+   * gradient with the other worker groups and update the Param locally.
+   *
    * @param param
    * @param step training step used for updating (e.g., deciding learning rate).
    */
@@ -275,8 +280,12 @@ class Worker {
   NeuralNet* train_net_ = nullptr;
   NeuralNet* test_net_ = nullptr;
   NeuralNet* val_net_ = nullptr;
-  Dealer* layer_dealer_ = nullptr;
-  Dealer* dealer_ = nullptr;
+  InprocDealer* layer_dealer_ = nullptr;
+  InprocDealer* dealer_ = nullptr;
+  //!< ring of workers with the same ID from all groups, for allreduce mode
+  RingAllreduce* allreduce_ = nullptr;
+  //!< updates Params locally in allreduce mode
+  Updater* updater_ = nullptr;
 };
 
 class BPWorker: public Worker {
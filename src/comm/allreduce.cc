@@ -0,0 +1,94 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+*
+*   http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include "comm/allreduce.h"
+
+#include <glog/logging.h>
+#include <string.h>
+#include "proto/common.pb.h"
+
+namespace singa {
+
+RingAllreduce::RingAllreduce(SocketInterface* socket, int rank,
+    const std::vector<int>& addrs)
+    : socket_(socket), rank_(rank), addrs_(addrs) {
+  CHECK_GE(rank_, 0);
+  CHECK_LT(rank_, static_cast<int>(addrs_.size()));
+}
+
+/**
+ * @return offset of the k-th of nchunks chunks of a buffer of n floats
+ */
+inline int ChunkOffset(int n, int nchunks, int k) {
+  return static_cast<int>(static_cast<long long>(n) * k / nchunks);
+}
+
+void RingAllreduce::SendChunk(const float* data, int n, int k, int round) {
+  int nranks = size();
+  int start = ChunkOffset(n, nranks, k), end = ChunkOffset(n, nranks, k + 1);
+  Msg* msg = new Msg(addrs_[rank_], addrs_[(rank_ + 1) % nranks]);
+  msg->set_type(kAllreduce);
+  msg->set_trgt(ncalls_, round);
+  msg->AddFrame(data + start, (end - start) * sizeof(float));
+  socket_->Send(&msg);
+}
+
+void RingAllreduce::ReceiveChunk(float* data, int n, int k, int round,
+    bool add) {
+  int nranks = size();
+  int start = ChunkOffset(n, nranks, k), end = ChunkOffset(n, nranks, k + 1);
+  Msg* msg = socket_->Receive();
+  CHECK_NOTNULL(msg);
+  CHECK_EQ(msg->type(), kAllreduce);
+  CHECK_EQ(msg->src(), addrs_[(rank_ + nranks - 1) % nranks]);
+  CHECK_EQ(msg->trgt_val(), ncalls_);
+  CHECK_EQ(msg->trgt_version(), round);
+  CHECK_EQ(msg->FrameSize(), static_cast<int>((end - start) * sizeof(float)));
+  msg->FirstFrame();
+  const float* chunk = static_cast<const float*>(msg->FrameData());
+  if (add) {
+    for (int i = start; i < end; i++)
+      data[i] += chunk[i - start];
+  } else {
+    memcpy(data + start, chunk, (end - start) * sizeof(float));
+  }
+  delete msg;
+}
+
+void RingAllreduce::Sum(float* data, int n) {
+  int nranks = size();
+  if (nranks > 1) {
+    // reduce-scatter: after it, chunk (rank_ + 1) % nranks is fully reduced
+    for (int r = 0; r < nranks - 1; r++) {
+      SendChunk(data, n, (rank_ - r + nranks) % nranks, r);
+      ReceiveChunk(data, n, (rank_ - r - 1 + nranks) % nranks, r, true);
+    }
+    // all-gather: pass the reduced chunks around
+    for (int r = 0; r < nranks - 1; r++) {
+      int round = nranks - 1 + r;
+      SendChunk(data, n, (rank_ + 1 - r + nranks) % nranks, round);
+      ReceiveChunk(data, n, (rank_ - r + nranks) % nranks, round, false);
+    }
+  }
+  ncalls_++;
+}
+
+}  // namespace singa
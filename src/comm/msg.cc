@@ -88,21 +88,72 @@ void Msg::LastFrame() {
 }
 
 void Msg::ParseFromZmsg(zmsg_t* msg) {
-  char* tmp = zmsg_popstr(msg);
-  sscanf(tmp, "%d %d %d %d %d",
-         &src_, &dst_, &type_, &trgt_val_, &trgt_version_);
+  zframe_t* frame = zmsg_pop(msg);
+  CHECK_EQ(zframe_size(frame), sizeof(MsgHeader));
+  MsgHeader header;
+  memcpy(&header, zframe_data(frame), sizeof(header));
+  zframe_destroy(&frame);
+  CHECK_EQ(header.version, kMsgHeaderVersion) << "incompatible msg header";
+  src_ = header.src;
+  dst_ = header.dst;
+  type_ = header.type;
+  trgt_val_ = header.trgt_val;
+  trgt_version_ = header.trgt_version;
   frame_ = zmsg_first(msg);
   msg_ = msg;
 }
 
 zmsg_t* Msg::DumpToZmsg() {
-  zmsg_pushstrf(msg_, "%d %d %d %d %d",
-      src_, dst_, type_, trgt_val_, trgt_version_);
+  CHECK_EQ(type_ & 0xffff, type_);
+  MsgHeader header;
+  header.version = kMsgHeaderVersion;
+  header.reserved = 0;
+  header.type = static_cast<uint16_t>(type_);
+  header.src = src_;
+  header.dst = dst_;
+  header.trgt_val = trgt_val_;
+  header.trgt_version = trgt_version_;
+  zmsg_pushmem(msg_, &header, sizeof(header));
   zmsg_t *tmp = msg_;
   msg_ = nullptr;
   return tmp;
 }
 
+void Msg::AppendMsg(Msg** msg) {
+  Msg* sub = *msg;
+  int nframes = zmsg_size(sub->msg_);
+  AddFormatFrame("iiiiii", sub->src_, sub->dst_, sub->type_, sub->trgt_val_,
+      sub->trgt_version_, nframes);
+  for (int i = 0; i < nframes; i++) {
+    zframe_t* frame = zmsg_pop(sub->msg_);
+    zmsg_append(msg_, &frame);
+  }
+  delete sub;
+  *msg = nullptr;
+}
+
+std::vector<Msg*> Msg::SplitMsgs() {
+  std::vector<Msg*> ret;
+  while (zmsg_size(msg_)) {
+    FirstFrame();
+    Msg* sub = new Msg();
+    int nframes;
+    ParseFormatFrame("iiiiii", &sub->src_, &sub->dst_, &sub->type_,
+        &sub->trgt_val_, &sub->trgt_version_, &nframes);
+    zframe_t* frame = zmsg_pop(msg_);
+    zframe_destroy(&frame);
+    for (int i = 0; i < nframes; i++) {
+      frame = zmsg_pop(msg_);
+      CHECK_NOTNULL(frame);
+      zmsg_append(sub->msg_, &frame);
+    }
+    sub->FirstFrame();
+    ret.push_back(sub);
+  }
+  frame_ = nullptr;
+  return ret;
+}
+
 // frame marker indicating this frame is serialize like printf
 #define FMARKER "*singa*"
 
@@ -163,41 +214,52 @@ int Msg::AddFormatFrame(const char *format, ...) {
 int Msg::ParseFormatFrame(const char *format, ...) {
   va_list argptr;
   va_start(argptr, format);
-  char* src = zframe_strdup(frame_);
-  CHECK_STREQ(FMARKER, src);
+  // parse in place, the frame is not null-terminated
+  const char* src = reinterpret_cast<const char*>(zframe_data(frame_));
+  int len = zframe_size(frame_);
   int size = strlen(FMARKER) + 1;
+  CHECK_GE(len, size);
+  CHECK_EQ(memcmp(FMARKER, src, size), 0) << "not a format frame";
   while (*format) {
     if (*format == 'i') {
       int *x = va_arg(argptr, int *);
+      CHECK_LE(size + 1 + sizeof(*x), len) << "short format frame";
       CHECK_EQ(src[size++], 'i');
       memcpy(x, src + size, sizeof(*x));
       size += sizeof(*x);
     } else if (*format == 'f') {
       float *x = va_arg(argptr, float *);
+      CHECK_LE(size + 1 + sizeof(*x), len) << "short format frame";
       CHECK_EQ(src[size++], 'f');
       memcpy(x, src + size, sizeof(*x));
       size += sizeof(*x);
     } else if (*format == '1') {
       uint8_t *x = va_arg(argptr, uint8_t *);
+      CHECK_LE(size + sizeof(*x), len) << "short format frame";
       memcpy(x, src + size, sizeof(*x));
       size += sizeof(*x);
     } else if (*format == '2') {
       uint16_t *x = va_arg(argptr, uint16_t *);
+      CHECK_LE(size + sizeof(*x), len) << "short format frame";
       memcpy(x, src + size, sizeof(*x));
       size += sizeof(*x);
     } else if (*format == '4') {
       uint32_t *x = va_arg(argptr, uint32_t *);
+      CHECK_LE(size + sizeof(*x), len) << "short format frame";
       memcpy(x, src + size, sizeof(*x));
       size += sizeof(*x);
     } else if (*format == 's') {
       char* x = va_arg(argptr, char *);
+      CHECK_LT(size, len) << "short format frame";
       CHECK_EQ(src[size++], 's');
-      int len = strlen(src + size);
-      memcpy(x, src + size, len);
-      x[len] = 0;
-      size += len + 1;
+      int slen = strnlen(src + size, len - size);
+      CHECK_LT(size + slen, len);
+      memcpy(x, src + size, slen);
+      x[slen] = 0;
+      size += slen + 1;
     } else if (*format == 'p') {
       void** x = va_arg(argptr, void **);
+      CHECK_LE(size + 1 + sizeof(*x), len) << "short format frame";
       CHECK_EQ(src[size++], 'p');
       memcpy(x, src + size, sizeof(*x));
       size += sizeof(*x);
@@ -207,7 +269,7 @@ int Msg::ParseFormatFrame(const char *format, ...) {
     format++;
   }
   va_end(argptr);
-  delete src;
+  CHECK_LE(size, len);
   return size;
 }
 #endif
@@ -21,6 +21,7 @@
 #include "comm/socket.h"
 
 #include <glog/logging.h>
+#include <thread>
 
 namespace singa {
 
@@ -177,4 +178,209 @@ void* Router::InternalID() const {
 }
 #endif
 
+/**************************InprocRouter*******************************/
+namespace {
+std::mutex endpoint_mtx;
+std::map<std::string, InprocRouter*> endpoint2router;
+}  // namespace
+
+InprocRouter::InprocRouter() : InprocRouter(1024) {}
+
+InprocRouter::InprocRouter(int capacity) : capacity_(capacity) {}
+
+InprocRouter::~InprocRouter() {
+  if (endpoint_.length()) {
+    std::lock_guard<std::mutex> lock(endpoint_mtx);
+    endpoint2router.erase(endpoint_);
+  }
+  Msg* msg = nullptr;
+  for (auto* channel : channels_) {
+    while (channel->up.Pop(&msg))
+      delete msg;
+    while (channel->down.Pop(&msg))
+      delete msg;
+    for (auto* overflow : channel->overflow)
+      delete overflow;
+    delete channel;
+  }
+  for (auto& it : bufmsg_)
+    for (auto* buf : it.second)
+      delete buf;
+}
+
+int InprocRouter::Bind(const std::string& endpoint) {
+  std::lock_guard<std::mutex> lock(endpoint_mtx);
+  if (endpoint2router.find(endpoint) != endpoint2router.end()) {
+    LOG(ERROR) << "endpoint " << endpoint << " is already bound";
+    return 0;
+  }
+  endpoint2router[endpoint] = this;
+  endpoint_ = endpoint;
+  return 1;
+}
+
+InprocRouter* InprocRouter::Lookup(const std::string& endpoint) {
+  std::lock_guard<std::mutex> lock(endpoint_mtx);
+  auto it = endpoint2router.find(endpoint);
+  return it == endpoint2router.end() ? nullptr : it->second;
+}
+
+InprocChannel* InprocRouter::AddChannel(bool learn_addr) {
+  auto* channel = new InprocChannel(capacity_, learn_addr);
+  std::lock_guard<std::mutex> lock(mtx_);
+  channels_.push_back(channel);
+  nchannels_.store(channels_.size(), std::memory_order_release);
+  return channel;
+}
+
+void InprocRouter::Deliver(InprocChannel* channel, Msg* msg) {
+  // keep msgs in order if some are already queued
+  if (channel->overflow.size() || !channel->down.Push(msg)) {
+    if (channel->overflow.empty()) {
+      nblocked_++;
+      channel->blocked = true;
+    }
+    channel->overflow.push_back(msg);
+  } else {
+    channel->bell.Ring();
+  }
+}
+
+void InprocRouter::Flush() {
+  for (auto* channel : local_) {
+    if (channel->overflow.empty())
+      continue;
+    bool pushed = false;
+    while (channel->overflow.size()
+        && channel->down.Push(channel->overflow.front())) {
+      channel->overflow.pop_front();
+      pushed = true;
+    }
+    if (pushed)
+      channel->bell.Ring();
+    if (channel->overflow.empty()) {
+      nblocked_--;
+      channel->blocked = false;
+    }
+  }
+}
+
+int InprocRouter::Send(Msg** msg) {
+  if (nblocked_)
+    Flush();
+  int dstid = (*msg)->dst();
+  auto it = id2channel_.find(dstid);
+  if (it != id2channel_.end()) {
+    Deliver(it->second, *msg);
+  } else {
+    // the dealer has not connected yet, buffer the message
+    bufmsg_[dstid].push_back(*msg);
+  }
+  *msg = nullptr;
+  return 1;
+}
+
+int InprocRouter::Send(Msg** msg, InprocChannel* channel) {
+  if (nblocked_)
+    Flush();
+  Deliver(channel, *msg);
+  *msg = nullptr;
+  return 1;
+}
+
+bool InprocRouter::Poll(Msg** msg) {
+  if (static_cast<int>(local_.size())
+      != nchannels_.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    local_ = channels_;
+  }
+  size_t n = local_.size();
+  for (size_t i = 0; i < n; i++) {
+    auto* channel = local_[(next_ + i) % n];
+    if (channel->up.Pop(msg)) {
+      next_ = (next_ + i + 1) % n;
+      if (channel->learn_addr
+          && id2channel_.find((*msg)->src()) == id2channel_.end()) {
+        // new connection, send buffered messages for it
+        int src = (*msg)->src();
+        id2channel_[src] = channel;
+        if (bufmsg_.find(src) != bufmsg_.end()) {
+          for (auto* buf : bufmsg_.at(src))
+            Deliver(channel, buf);
+          bufmsg_.erase(src);
+        }
+      }
+      (*msg)->FirstFrame();
+      return true;
+    }
+  }
+  return false;
+}
+
+Msg* InprocRouter::Receive() {
+  return Receive(-1);
+}
+
+Msg* InprocRouter::Receive(int timeout) {
+  Msg* msg = nullptr;
+  auto ready = [this, &msg]() {
+    if (nblocked_)
+      Flush();
+    return Poll(&msg);
+  };
+  if (!ready() && timeout != 0)
+    bell_.Wait(ready, timeout);
+  return msg;
+}
+
+void* InprocRouter::InternalID() const {
+  return const_cast<InprocRouter*>(this);
+}
+
+/**************************InprocDealer*******************************/
+InprocDealer::InprocDealer() : InprocDealer(-1) {}
+
+InprocDealer::InprocDealer(int id) : id_(id) {}
+
+int InprocDealer::Connect(const std::string& endpoint, bool learn_addr) {
+  router_ = InprocRouter::Lookup(endpoint);
+  if (router_ == nullptr) {
+    LOG(ERROR) << "no router is bound to " << endpoint;
+    return 0;
+  }
+  channel_ = router_->AddChannel(learn_addr);
+  return 1;
+}
+
+int InprocDealer::Send(Msg** msg) {
+  CHECK_NOTNULL(channel_);
+  while (!channel_->up.Push(*msg))
+    std::this_thread::yield();
+  router_->Ring();
+  *msg = nullptr;
+  return 1;
+}
+
+Msg* InprocDealer::Receive() {
+  return Receive(-1);
+}
+
+Msg* InprocDealer::Receive(int timeout) {
+  CHECK_NOTNULL(channel_);
+  Msg* msg = nullptr;
+  auto& down = channel_->down;
+  if (!down.Pop(&msg) && timeout != 0)
+    channel_->bell.Wait([&down, &msg]() { return down.Pop(&msg); }, timeout);
+  if (msg != nullptr) {
+    if (channel_->blocked)
+      router_->Ring();
+    msg->FirstFrame();
+  }
+  return msg;
+}
+
+void* InprocDealer::InternalID() const {
+  return channel_;
+}
+
 }  // namespace singa
@@ -22,6 +22,9 @@
 #include "./driver.h"
 
 #include <glog/logging.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -62,6 +65,7 @@ void Driver::Init(int argc, char **argv) {
   RegisterLayer<ConcateLayer, int>(kConcate);
   RegisterLayer<DropoutLayer, int>(kDropout);
   RegisterLayer<EuclideanLossLayer, int>(kEuclideanLoss);
+  RegisterLayer<ImageDecodeLayer, int>(kImageDecode);
   RegisterLayer<InnerProductLayer, int>(kInnerProduct);
   RegisterLayer<LabelLayer, int>(kLabel);
   RegisterLayer<LRNLayer, int>(kLRN);
@@ -77,7 +81,9 @@ void Driver::Init(int argc, char **argv) {
   RegisterLayer<SliceLayer, int>(kSlice);
   RegisterLayer<SoftmaxLossLayer, int>(kSoftmaxLoss);
   RegisterLayer<SplitLayer, int>(kSplit);
+  RegisterLayer<StreamDataLayer, int>(kStreamData);
   RegisterLayer<STanhLayer, int>(kSTanh);
+  RegisterLayer<TensorDataLayer, int>(kTensorData);
 #ifdef USE_LMDB
   RegisterLayer<LMDBDataLayer, int>(kLMDBData);
 #endif
@@ -111,6 +117,16 @@ void Driver::Init(int argc, char **argv) {
   RegisterParamGenerator<GaussianSqrtFanInGen>(kGaussianSqrtFanIn);
   RegisterParamGenerator<UniformSqrtFanInGen>(kUniformSqrtFanIn);
   RegisterParamGenerator<UniformSqrtFanInOutGen>(kUniformSqrtFanInOut);
+
+  // register gradient codecs
+  RegisterGradCodec<FP16Codec>(kFP16Codec);
+  RegisterGradCodec<TopKCodec>(kTopKCodec);
+  RegisterGradCodec<SignCodec>(kSignCodec);
+
+  // register sync strategies between server groups
+  RegisterGroupSync<DownpourSync>(kDownpourSync);
+  RegisterGroupSync<EASGDSync>(kEASGDSync);
+  RegisterGroupSync<AvgSync>(kAvgSync);
 }
 
 void Driver::Train(bool resume, const JobProto& job_conf) {
@@ -140,16 +156,21 @@ void Driver::Train(const JobProto& job_conf) {
   int grp_size = cluster->nworkers_per_group();
   Stub stub;
   // no need to create Stub if there is only a single worker without servers,
-  // i.e., the training will be conducted by the single worker.
-  if (grp_size > 1 || nserver_grps > 0) {
+  // i.e., the training will be conducted by the single worker. In allreduce
+  // mode, the Stub routes chunks among worker groups even without servers.
+  bool has_stub = grp_size > 1 || nserver_grps > 0 || cluster->allreduce();
+  if (has_stub) {
     stub.Setup();
     // TODO(wangwei)  register endpoint to zookeeper if > 1 procs;
     cluster->Register(getpid(), stub.endpoint());  // getpid() is from unistd.h
   }
 
   NeuralNet* net = NeuralNet::Create(job_conf.neuralnet(), kTrain, grp_size);
+  if (nserver_grps > 0)
+    PartitionParams(net);
   const vector<Worker*> workers = CreateWorkers(job_conf, net);
-  const vector<Server*> servers = CreateServers(job_conf, net);
+  const vector<Server*> servers = nserver_grps > 0
+    ? CreateServers(job_conf, net) : vector<Server*>{};
 
 #ifdef USE_MPI
   int nthreads = workers.size() + servers.size() + 1;
@@ -162,13 +183,8 @@ void Driver::Train(const JobProto& job_conf) {
     threads.push_back(std::thread(&Server::Run, server));
   for (auto worker : workers)
     threads.push_back(std::thread(&Worker::Run, worker));
-  if (grp_size > 1 || nserver_grps > 0) {
-    int nservers_per_grp = cluster->nservers_per_group();
-    int lcm = LeastCommonMultiple(nservers_per_grp, nserver_grps);
-    auto slices = Param::ComputeSlices(lcm, net->params());
-    auto slice2server = PartitionSlices(nservers_per_grp, slices);
-    stub.Run(slice2server, workers, servers);
-  }
+  if (has_stub)
+    stub.Run(slice2server_, workers, servers);
 
   for (auto& thread : threads)
     thread.join();
@@ -190,39 +206,56 @@ void Driver::SetupForResume(JobProto* job_conf) {
   tinydir_dir dir;
   std::string folder = Cluster::Get()->checkpoint_folder();
   tinydir_open(&dir, folder.c_str());
-  int latest_step = 0;
   // there would be multi checkpoint files (from diff workers) for one step
-  vector<std::string> ck_files;
-  // iterate all files to get the files for the last checkpoint
+  std::map<int, vector<std::string>> ck_files;
+  // raw checkpoint files of slices from servers, see server_checkpoint
+  std::map<int, vector<std::string>> server_files;
+  // iterate all files to get the files of each checkpoint step
   while (dir.has_next) {
     tinydir_file file;
     tinydir_readfile(&dir, &file);
     tinydir_next(&dir);
     char* ch = strstr(file.name, "step");
-    if (ch == nullptr) {
+    // files being written by servers end with .tmp
+    if (ch == nullptr || strstr(file.name, ".tmp") != nullptr) {
       if (file.name[0] != '.')
         LOG(INFO) << "Irregular file in checkpoint folder: " << file.name;
       continue;
     }
     LOG(INFO) << "Add checkpoint file for resume: " << ch;
     int step = atoi(ch+4);
-    if (step == latest_step) {
-      ck_files.push_back(file.name);
-    } else if (step > latest_step) {
-      latest_step = step;
-      ck_files.clear();
-      ck_files.push_back(std::string(file.name));
-    }
+    if (strstr(file.name, "-server"))
+      server_files[step].push_back(file.name);
+    else
+      ck_files[step].push_back(file.name);
+  }
+  tinydir_close(&dir);
+  // every server writes one file per checkpoint step, hence the slices of a
+  // step can be restored only if all servers have written theirs
+  auto cluster = Cluster::Get();
+  size_t nservers = cluster->nserver_groups() * cluster->nservers_per_group();
+  int latest_step = 0;
+  if (ck_files.size())
+    latest_step = ck_files.rbegin()->first;
+  for (auto& entry : server_files) {
+    if (entry.second.size() == nservers)
+      latest_step = std::max(latest_step, entry.first);
+    else
+      LOG(WARNING) << "Incomplete server checkpoint of step " << entry.first
+        << ": " << entry.second.size() << " of " << nservers << " files";
   }
   if (latest_step > 0) {
     job_conf->set_step(latest_step);
     if (!job_conf->has_reset_param_version())
       job_conf->set_reset_param_version(false);
     job_conf->clear_checkpoint_path();
-    for (auto ck_file : ck_files)
+    for (auto ck_file : ck_files[latest_step])
       job_conf->add_checkpoint_path(folder + "/" + ck_file);
+    job_conf->clear_server_checkpoint_path();
+    if (server_files[latest_step].size() == nservers)
+      for (auto server_file : server_files[latest_step])
+        job_conf->add_server_checkpoint_path(folder + "/" + server_file);
   }
-  tinydir_close(&dir);
 }
 
 const vector<Worker*> Driver::CreateWorkers(const JobProto& job_conf,
@@ -272,20 +305,23 @@ const vector<Worker*> Driver::CreateWorkers(const JobProto& job_conf,
   return workers;
 }
 
-const vector<Server*> Driver::CreateServers(const JobProto& job_conf,
-    NeuralNet* net) {
+void Driver::PartitionParams(NeuralNet* net) {
   auto cluster = Cluster::Get();
-  vector<Server*> servers;
-  if (!cluster->has_server()) return servers;
   int nservers_per_grp = cluster->nservers_per_group();
   int nserver_grps = cluster->nserver_groups();
   int lcm = LeastCommonMultiple(nserver_grps, nservers_per_grp);
   auto slices = Param::ComputeSlices(lcm, net->params());
   // partition among server groups, each group maintains one sub-set for sync
-  auto slice2group = PartitionSlices(nserver_grps, slices);
+  slice2group_ = PartitionSlices(nserver_grps, slices);
   // partition within one server group, each server updates for one sub-set
-  auto slice2server = PartitionSlices(nservers_per_grp, slices);
+  slice2server_ = PartitionSlices(nservers_per_grp, slices);
+}
 
+const vector<Server*> Driver::CreateServers(const JobProto& job_conf,
+    NeuralNet* net) {
+  auto cluster = Cluster::Get();
+  vector<Server*> servers;
+  if (!cluster->has_server()) return servers;
   int server_procs = cluster->procs_id();
   // if true, server procs (logical) id starts after worker procs
   if (cluster->server_worker_separate())
@@ -295,7 +331,8 @@ const vector<Server*> Driver::CreateServers(const JobProto& job_conf,
   int gstart = rng[0], gend = rng[1], start = rng[2], end = rng[3];
   for (int gid = gstart; gid < gend; gid++) {
     for (int sid = start; sid < end; sid++) {
-      auto server = new Server(gid, sid, job_conf, slice2group, slice2server);
+      auto server = new Server(gid, sid, job_conf, slice2group_,
+          slice2server_);
       servers.push_back(server);
     }
   }
@@ -21,6 +21,11 @@
 
 #include "neuralnet/input_layer.h"
 
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+
 #include "mshadow/tensor.h"
 
 namespace singa {
@@ -34,6 +39,17 @@ using std::string;
 using std::vector;
 
 /************* Implementation for ParserLayer ***********/
+ParserLayer::~ParserLayer() {
+  delete pool_;
+}
+
+void ParserLayer::Setup(const LayerProto& proto,
+    const vector<Layer*>& srclayers) {
+  Layer::Setup(proto, srclayers);
+  delete pool_;
+  pool_ = new ThreadPool(proto.parser_conf().num_threads());
+}
+
 void ParserLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
   CHECK_EQ(srclayers.size(), 1);
   auto datalayer = dynamic_cast<DataLayer*>(*srclayers.begin());
@@ -43,8 +59,13 @@ void ParserLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
 #ifdef USE_LMDB
 /*********************LMDBDataLayer**********************************/
 LMDBDataLayer::~LMDBDataLayer() {
-  mdb_cursor_close(mdb_cursor_);
-  mdb_txn_abort(mdb_txn_);
+  if (prefetch_thread_.joinable())
+    prefetch_thread_.join();
+  if (mdb_cursor_ != nullptr) {
+    mdb_cursor_close(mdb_cursor_);
+    mdb_txn_abort(mdb_txn_);
+    mdb_env_close(mdb_env_);
+  }
   mdb_cursor_ = nullptr;
 }
 
@@ -54,25 +75,30 @@ void LMDBDataLayer::Setup(const LayerProto& proto,
   OpenLMDB(proto.lmdbdata_conf().path());
   CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT),
            MDB_SUCCESS);
-  mdb_cursor_close(mdb_cursor_);
-  mdb_txn_abort(mdb_txn_);
-  mdb_cursor_ = nullptr;
   CaffeDatum datum;
   datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
   SingleLabelImageRecord* record = sample_.mutable_image();
-  ConvertCaffeDatumToRecord(datum, record);
+  ConvertCaffeDatumToRecord(&datum, record);
+  mdb_cursor_close(mdb_cursor_);
+  mdb_txn_abort(mdb_txn_);
+  mdb_env_close(mdb_env_);
+  mdb_cursor_ = nullptr;
   batchsize_ = proto.lmdbdata_conf().batchsize();
   if (partition_dim() == 0)
     batchsize_ /= proto.num_partitions();
   records_.resize(batchsize_);
+  prefetch_records_.resize(batchsize_);
   random_skip_ = proto.lmdbdata_conf().random_skip();
 }
 
 void LMDBDataLayer::OpenLMDB(const std::string& path) {
   CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
   CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776), MDB_SUCCESS);  // 1TB
+  // MDB_NOTLS allows the read-only transaction to be used by the prefetching
+  // thread, which never runs concurrently with other readers of this layer
   CHECK_EQ(mdb_env_open(mdb_env_, path.c_str(),
-           MDB_RDONLY, 0664), MDB_SUCCESS) << "cannot open lmdb " << path;
+           MDB_RDONLY | MDB_NOTLS, 0664), MDB_SUCCESS)
+      << "cannot open lmdb " << path;
   CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn_), MDB_SUCCESS)
       << "mdb_txn_begin failed";
   CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
@@ -88,63 +114,64 @@ void LMDBDataLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
   if (mdb_cursor_ == nullptr)
     OpenLMDB(layer_conf_.lmdbdata_conf().path());
   if (random_skip_) {
-    int nskip = rand() % random_skip_;
-    int n = 0;
-    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-             &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-    while (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-           &mdb_value_, MDB_NEXT) == MDB_SUCCESS)
-      n++;
+    MDB_stat stat;
+    CHECK_EQ(mdb_stat(mdb_txn_, mdb_dbi_, &stat), MDB_SUCCESS);
+    CHECK_GT(stat.ms_entries, 0);
+    // skipping more than one round is wasted work
+    int nskip = (rand() % random_skip_) % stat.ms_entries;
     LOG(INFO) << "Random Skip " << nskip << " records of total "
-              << n << "records";
+              << stat.ms_entries << "records";
+    for (int i = 0; i < nskip; i++)
+      NextRecord();
+    random_skip_ = 0;
+  }
+  if (prefetch_thread_.joinable())
+    prefetch_thread_.join();
+  else
+    ReadRecords(&prefetch_records_);
+  records_.swap(prefetch_records_);
+  // read the next mini-batch while this one is being processed
+  prefetch_thread_ = std::thread(&LMDBDataLayer::ReadRecords, this,
+      &prefetch_records_);
+}
+
+void LMDBDataLayer::NextRecord() {
+  if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
+      &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
     // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
     CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
              &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-    for (int i = 0; i < nskip; i++) {
-      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-          &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-                 &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-      }
-    }
-    random_skip_ = 0;
   }
+}
+
+void LMDBDataLayer::ReadRecords(vector<Record>* records) {
   CaffeDatum datum;
-  for (auto& record : records_) {
-    SingleLabelImageRecord* image = record.mutable_image();
+  for (auto& record : *records) {
     CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
     datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
-    ConvertCaffeDatumToRecord(datum, image);
-    if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-        &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-               &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-    }
+    ConvertCaffeDatumToRecord(&datum, record.mutable_image());
+    NextRecord();
   }
 }
 
-void LMDBDataLayer::ConvertCaffeDatumToRecord(const CaffeDatum& datum,
+void LMDBDataLayer::ConvertCaffeDatumToRecord(CaffeDatum* datum,
                                               SingleLabelImageRecord* record) {
-  record->set_label(datum.label());
+  record->set_label(datum->label());
   record->clear_shape();
-  if (datum.has_channels())
-    record->add_shape(datum.channels());
-  if (datum.has_height())
-    record->add_shape(datum.height());
-  if (datum.has_width())
-    record->add_shape(datum.width());
-  if (datum.has_data())
-    record->set_pixel(datum.data());
-  if (datum.float_data_size()) {
-    record->clear_data();
-    for (float x : datum.float_data())
-      record->add_data(x);
-  }
+  if (datum->has_channels())
+    record->add_shape(datum->channels());
+  if (datum->has_height())
+    record->add_shape(datum->height());
+  if (datum->has_width())
+    record->add_shape(datum->width());
+  // swap the buffers instead of copying, the datum is reset by the next parse
+  if (datum->has_data())
+    record->mutable_pixel()->swap(*datum->mutable_data());
+  record->set_encoded(datum->encoded());
+  if (datum->float_data_size())
+    record->mutable_data()->Swap(datum->mutable_float_data());
 }
 #endif
 
@@ -172,24 +199,242 @@ void ShardDataLayer::Setup(const LayerProto& proto,
 }
 
 void ShardDataLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
-  if (shard_ == nullptr)
+  if (shard_ == nullptr) {
     shard_ = new DataShard(layer_conf_.sharddata_conf().path(),
                            DataShard::kRead);
+    if (layer_conf_.sharddata_conf().partition() && nparts_ > 1) {
+      // equal-sized parts; the remaining records at the end are not read
+      int count = shard_->Count();
+      int size = count / nparts_;
+      CHECK_GT(size, 0) << "Cannot partition " << count << " records into "
+                        << nparts_ << " parts";
+      start_ = part_id_ * size;
+      end_ = start_ + size;
+      LOG(INFO) << "Read records [" << start_ << ", " << end_ << ") of "
+                << count << " records, part " << part_id_ << "/" << nparts_;
+    }
+    cursor_ = start_;
+    CHECK(shard_->SeekTo(start_));
+  }
   if (random_skip_) {
     int nskip = rand() % random_skip_;
-    LOG(INFO) << "Random Skip " << nskip << " records, there are "
-              << shard_->Count() << " records in total";
-    string key;
-    for (int i = 0; i < nskip; i++) {
-      shard_->Next(&key, &sample_);
-    }
+    if (end_ > 0)
+      nskip %= end_ - start_;
+    LOG(INFO) << "Random Skip " << nskip << " records";
+    for (int i = 0; i < nskip; i++)
+      NextRecord(&sample_);
     random_skip_ = 0;
   }
+  for (auto& record : records_)
+    NextRecord(&record);
+}
+
+void ShardDataLayer::NextRecord(Record* record) {
+  string key;
+  if (cursor_ == end_ || !shard_->Next(&key, record)) {
+    CHECK(shard_->SeekTo(start_));
+    CHECK(shard_->Next(&key, record));
+    cursor_ = start_;
+  }
+  cursor_++;
+}
+
+/***************Implementation for TensorDataLayer*************************/
+TensorDataLayer::~TensorDataLayer() {
+  delete shard_;
+}
+
+void TensorDataLayer::Setup(const LayerProto& proto,
+    const vector<Layer*>& srclayers) {
+  Layer::Setup(proto, srclayers);
+  shard_ = new TensorShard(proto.tensordata_conf().path());
+  batchsize_ = proto.tensordata_conf().batchsize();
+  if (partition_dim() == 0)
+    batchsize_ /= proto.num_partitions();
+  random_skip_ = proto.tensordata_conf().random_skip();
+  vector<int> shape = shard_->shape();
+  shape.insert(shape.begin(), batchsize_);
+  data_.Reshape(shape);
+  label_.Reshape(vector<int>{batchsize_});
+}
+
+void TensorDataLayer::ComputeFeature(int flag,
+    const vector<Layer*>& srclayers) {
+  if (end_ == 0) {
+    // first call, after set_data_partition() has taken effect
+    start_ = 0;
+    end_ = shard_->nrows();
+    if (layer_conf_.tensordata_conf().partition() && nparts_ > 1) {
+      int64_t size = shard_->nrows() / nparts_;
+      start_ = part_id_ * size;
+      end_ = start_ + size;
+    }
+    CHECK_GE(end_ - start_, batchsize_) << "Too few rows for one mini-batch";
+    cursor_ = start_;
+    if (random_skip_) {
+      int nskip = rand() % random_skip_;
+      LOG(INFO) << "Random Skip " << nskip << " records";
+      cursor_ += nskip % (end_ - start_ - batchsize_ + 1);
+      random_skip_ = 0;
+    }
+  }
+  if (cursor_ + batchsize_ > end_)
+    cursor_ = start_;
+  data_.set_cpu_data(shard_->row(cursor_));
+  if (shard_->has_label())
+    label_.set_cpu_data(shard_->label(cursor_));
+  cursor_ += batchsize_;
+}
+
+const Blob<float>& TensorDataLayer::data(const Layer* from) const {
+  if (shard_->has_label() && dynamic_cast<const LossLayer*>(from) != nullptr)
+    return label_;
+  return data_;
+}
+
+/***************Implementation for StreamDataLayer*************************/
+// timeout in milliseconds for the receiving thread to check stop_
+const int kStreamPollTime = 100;
+
+StreamDataLayer::~StreamDataLayer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  space_cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+  if (sock_ != nullptr)
+    zsock_destroy(&sock_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+void StreamDataLayer::Setup(const LayerProto& proto,
+    const vector<Layer*>& srclayers) {
+  Layer::Setup(proto, srclayers);
+  const StreamDataProto& conf = proto.streamdata_conf();
+  endpoint_ = conf.endpoint();
+  batchsize_ = conf.batchsize();
+  if (partition_dim() == 0)
+    batchsize_ /= proto.num_partitions();
+  buffer_size_ = std::max(conf.buffer_size(), batchsize_);
+  records_.resize(batchsize_);
+  if (endpoint_.find("://") != string::npos) {
+    sock_ = zsock_new(ZMQ_PULL);
+    CHECK_NOTNULL(sock_);
+    // bound the messages queued by ZeroMQ in addition to buffer_
+    zsock_set_rcvhwm(sock_, buffer_size_);
+    if (conf.bind())
+      CHECK_NE(zsock_bind(sock_, "%s", endpoint_.c_str()), -1) << endpoint_;
+    else
+      CHECK_EQ(zsock_connect(sock_, "%s", endpoint_.c_str()), 0) << endpoint_;
+  }
+  thread_ = std::thread(&StreamDataLayer::Receive, this);
+  // the first record is used as the sample for setting up the parser layers
+  LOG(INFO) << "Waiting for the first record from " << endpoint_;
+  std::unique_lock<std::mutex> lock(mutex_);
+  data_cv_.wait(lock, [this] { return !buffer_.empty(); });
+  sample_ = buffer_.front();
+}
+
+void StreamDataLayer::ComputeFeature(int flag,
+    const vector<Layer*>& srclayers) {
+  std::unique_lock<std::mutex> lock(mutex_);
   for (auto& record : records_) {
-    string key;
-    if (!shard_->Next(&key, &record)) {
-      shard_->SeekToFirst();
-      CHECK(shard_->Next(&key, &record));
+    data_cv_.wait(lock, [this] { return !buffer_.empty(); });
+    record.Swap(&buffer_.front());
+    buffer_.pop_front();
+    space_cv_.notify_one();
+  }
+}
+
+bool StreamDataLayer::Push(const char* data, size_t size) {
+  Record record;
+  if (!record.ParseFromArray(data, size)) {
+    LOG(ERROR) << "Drop a record which cannot be parsed";
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  space_cv_.wait(lock, [this] {
+    return stop_ || buffer_.size() < buffer_size_;
+  });
+  if (stop_)
+    return false;
+  buffer_.push_back(Record());
+  buffer_.back().Swap(&record);
+  data_cv_.notify_one();
+  return true;
+}
+
+bool StreamDataLayer::ReadPipe(char* buf, size_t size) {
+  while (size > 0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_)
+        return false;
+    }
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    if (poll(&pfd, 1, kStreamPollTime) <= 0)
+      continue;
+    ssize_t n = read(fd_, buf, size);
+    if (n <= 0)
+      return false;
+    buf += n;
+    size -= n;
+  }
+  return true;
+}
+
+void StreamDataLayer::Receive() {
+  if (sock_ != nullptr) {
+    zpoller_t* poller = zpoller_new(sock_, nullptr);
+    bool running = true;
+    while (running) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_)
+          break;
+      }
+      if (zpoller_wait(poller, kStreamPollTime) == nullptr)
+        continue;
+      zmsg_t* zmsg = zmsg_recv(sock_);
+      if (zmsg == nullptr)
+        break;
+      for (zframe_t* frame = zmsg_first(zmsg); frame != nullptr && running;
+           frame = zmsg_next(zmsg))
+        running = Push(reinterpret_cast<const char*>(zframe_data(frame)),
+            zframe_size(frame));
+      zmsg_destroy(&zmsg);
+    }
+    zpoller_destroy(&poller);
+  } else {
+    string buf;
+    while (true) {
+      if (fd_ < 0) {
+        // O_NONBLOCK to avoid blocking in open() until a writer comes
+        fd_ = open(endpoint_.c_str(), O_RDONLY | O_NONBLOCK);
+        CHECK_GE(fd_, 0) << "Cannot open " << endpoint_;
+      }
+      uint32_t len;
+      if (ReadPipe(reinterpret_cast<char*>(&len), sizeof(len))) {
+        buf.resize(len);
+        if (ReadPipe(&buf[0], len)) {
+          if (!Push(buf.data(), len))
+            break;
+          continue;
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_)
+          break;
+      }
+      // the writer has closed the pipe (or has not opened it), wait for the
+      // next writer
+      close(fd_);
+      fd_ = -1;
+      std::this_thread::sleep_for(std::chrono::milliseconds(kStreamPollTime));
     }
   }
 }
@@ -197,7 +442,7 @@ void ShardDataLayer::ComputeFeature(int flag, const vector<Layer*>& srclayers) {
 /********* Implementation for LabelLayer **************/
 void LabelLayer::Setup(const LayerProto& proto,
     const vector<Layer*>& srclayers) {
-  Layer::Setup(proto, srclayers);
+  ParserLayer::Setup(proto, srclayers);
   CHECK_EQ(srclayers.size(), 1);
   int batchsize = dynamic_cast<DataLayer*>(srclayers[0])->batchsize();
   data_.Reshape(vector<int>{batchsize});
@@ -221,37 +466,33 @@ void MnistLayer::ParseRecords(int flag, const vector<Record>& records,
   int ndim = records.at(0).image().shape_size();
   int inputsize = records.at(0).image().shape(ndim-1);
   CHECK_EQ(inputsize, blob->shape()[2]);
+  int size = inputsize * inputsize;
+  CHECK_EQ(size * static_cast<int>(records.size()), blob->count());
 
   float* dptr = blob->mutable_cpu_data();
-  for (const Record& record : records) {
-    const SingleLabelImageRecord& imagerecord = record.image();
-    if (imagerecord.pixel().size()) {
-      string pixel = imagerecord.pixel();
-      for (int i = 0, k = 0; i < inputsize; i++) {
-        for (int j = 0; j < inputsize; j++) {
-          // NOTE!!! must cast pixel to uint8_t then to float!!! waste a lot of
-          // time to debug this
-          float x =  static_cast<float>(static_cast<uint8_t>(pixel[k++]));
-          x = x / norm_a_-norm_b_;
-          *dptr = x;
-          dptr++;
-        }
-      }
-    } else {
-      for (int i = 0, k = 0; i < inputsize; i++) {
-        for (int j = 0; j < inputsize; j++) {
-          *dptr = imagerecord.data(k++) / norm_a_ - norm_b_;
-          dptr++;
-        }
+  // x / norm_a - norm_b
+  float scale = 1.0f / norm_a_, bias = -norm_b_;
+  pool_->ParallelFor(records.size(), [&](int tid, int start, int end) {
+    for (int rid = start; rid < end; rid++) {
+      const SingleLabelImageRecord& imagerecord = records[rid].image();
+      float* dst = dptr + rid * size;
+      if (imagerecord.pixel().size()) {
+        // NOTE!!! must cast pixel to uint8_t then to float!!! waste a lot of
+        // time to debug this
+        PixelsToFloat(
+            reinterpret_cast<const uint8_t*>(imagerecord.pixel().data()),
+            size, nullptr, scale, bias, dst);
+      } else {
+        for (int k = 0; k < size; k++)
+          dst[k] = imagerecord.data(k) * scale + bias;
       }
     }
-  }
-  CHECK_EQ(dptr, blob->mutable_cpu_data() + blob->count());
+  });
 }
 
 void MnistLayer::Setup(const LayerProto& proto,
     const vector<Layer*>& srclayers) {
-  Layer::Setup(proto, srclayers);
+  ParserLayer::Setup(proto, srclayers);
   CHECK_EQ(srclayers.size(), 1);
   int batchsize = dynamic_cast<DataLayer*>(srclayers[0])->batchsize();
   Record sample = dynamic_cast<DataLayer*>(srclayers[0])->sample();
@@ -265,82 +506,98 @@ void MnistLayer::Setup(const LayerProto& proto,
 }
 
 /*************** Implementation for RGBImageLayer *************************/
-void RGBImageLayer::ParseRecords(int flag, const vector<Record>& records,
-    Blob<float>* blob) {
-  const vector<int>& s = blob->shape();
-  Tensor<cpu, 4> images(data_.mutable_cpu_data(),
-      Shape4(s[0], s[1], s[2], s[3]));
-  const SingleLabelImageRecord& r = records.at(0).image();
-  Tensor<cpu, 3> raw_image(Shape3(r.shape(0), r.shape(1), r.shape(2)));
-  AllocSpace(raw_image);
-  Tensor<cpu, 3> croped_image(nullptr, Shape3(s[1], s[2], s[3]));
-  if (cropsize_)
-    AllocSpace(croped_image);
-  int rid = 0;
-  const float* meandptr = mean_.cpu_data();
-  for (const Record& record : records) {
-    auto image = images[rid];
-    bool do_crop = cropsize_> 0 && ((flag & kTrain) == kTrain);
-    bool do_mirror = mirror_ && rand() % 2 && ((flag & kTrain) == kTrain);
-    float* dptr = nullptr;
-    if (do_crop || do_mirror)
-      dptr = raw_image.dptr;
-    else
-      dptr = image.dptr;
-    if (record.image().pixel().size()) {
-      string pixel = record.image().pixel();
-      for (size_t i = 0; i < pixel.size(); i++)
-        dptr[i] = static_cast<float>(static_cast<uint8_t>(pixel[i]));
-    } else {
-      memcpy(dptr, record.image().data().data(),
-          sizeof(float) * record.image().data_size());
+void RGBImageLayer::Transform(int tid, bool train, const uint8_t* pixel,
+    const float* data, int height, int width, float* dst) {
+  CHECK_GE(height, croph_);
+  CHECK_GE(width, cropw_);
+  // random crop and mirror for training; center crop otherwise
+  int hoff = (height - croph_) / 2, woff = (width - cropw_) / 2;
+  bool mirror = false;
+  if (train) {
+    std::mt19937* rng = &rngs_.at(tid);
+    if (cropsize_) {
+      hoff = std::uniform_int_distribution<int>(0, height - croph_)(*rng);
+      woff = std::uniform_int_distribution<int>(0, width - cropw_)(*rng);
     }
-    for (int i = 0; i < mean_.count(); i++)
-      dptr[i] -= meandptr[i];
-    if (do_crop) {
-      int hoff = rand() % (r.shape(1) - cropsize_);
-      int woff = rand() % (r.shape(2) - cropsize_);
-      Shape<2> cropshape = Shape2(cropsize_, cropsize_);
-      if (do_mirror) {
-        croped_image = expr::crop(raw_image, cropshape, hoff, woff);
-        image = expr::mirror(croped_image);
+    mirror = mirror_ && std::bernoulli_distribution(0.5)(*rng);
+  }
+  const float* mean = has_mean_ ? mean_.cpu_data() : nullptr;
+  if (mean != nullptr) {
+    CHECK_EQ(height, mean_.shape()[1]);
+    CHECK_EQ(width, mean_.shape()[2]);
+  }
+  float scale = scale_ ? scale_ : 1.0f;
+  for (int c = 0; c < channels_; c++) {
+    for (int h = 0; h < croph_; h++) {
+      int offset = (c * height + h + hoff) * width + woff;
+      const float* meanrow = mean == nullptr ? nullptr : mean + offset;
+      float* dstrow = dst + (c * croph_ + h) * cropw_;
+      if (pixel != nullptr) {
+        PixelsToFloat(pixel + offset, cropw_, meanrow, scale, 0.0f, dstrow);
       } else {
-        image = expr::crop(raw_image, cropshape, hoff, woff);
+        for (int w = 0; w < cropw_; w++)
+          dstrow[w] = (data[offset + w] - (meanrow ? meanrow[w] : 0)) * scale;
       }
-    } else if (do_mirror) {
-      image = expr::mirror(raw_image);
+      // the row is hot in cache, reversing it is cheaper than scalar
+      // conversion with reversed indexing
+      if (mirror)
+        std::reverse(dstrow, dstrow + cropw_);
     }
-    rid++;
   }
-  if (scale_)
-    images = images * scale_;
-  FreeSpace(raw_image);
-  if (cropsize_)
-    FreeSpace(croped_image);
+}
+
+void RGBImageLayer::ParseImage(int tid, bool train,
+    const SingleLabelImageRecord& image, float* dst) {
+  CHECK(!image.encoded()) << "Use kImageDecode layer for encoded images";
+  CHECK_EQ(image.shape(0), channels_);
+  const uint8_t* pixel = nullptr;
+  if (image.pixel().size())
+    pixel = reinterpret_cast<const uint8_t*>(image.pixel().data());
+  Transform(tid, train, pixel, image.data().data(), image.shape(1),
+      image.shape(2), dst);
+}
+
+void RGBImageLayer::ParseRecords(int flag, const vector<Record>& records,
+    Blob<float>* blob) {
+  bool train = (flag & kTrain) == kTrain;
+  int size = channels_ * croph_ * cropw_;
+  float* dptr = blob->mutable_cpu_data();
+  pool_->ParallelFor(records.size(), [&](int tid, int start, int end) {
+    for (int rid = start; rid < end; rid++)
+      ParseImage(tid, train, records[rid].image(), dptr + rid * size);
+  });
 }
 
 void RGBImageLayer::Setup(const LayerProto& proto,
     const vector<Layer*>& srclayers) {
   ParserLayer::Setup(proto, srclayers);
   CHECK_EQ(srclayers.size(), 1);
+  int batchsize = dynamic_cast<DataLayer*>(srclayers[0])->batchsize();
+  Record sample = dynamic_cast<DataLayer*>(srclayers[0])->sample();
+  CHECK_EQ(sample.image().shape_size(), 3);
+  SetupTransform(proto, batchsize, sample.image().shape(0),
+      sample.image().shape(1), sample.image().shape(2));
+}
+
+void RGBImageLayer::SetupTransform(const LayerProto& proto, int batchsize,
+    int channels, int height, int width) {
   scale_ = proto.rgbimage_conf().scale();
   cropsize_ = proto.rgbimage_conf().cropsize();
   mirror_ = proto.rgbimage_conf().mirror();
-  int batchsize = dynamic_cast<DataLayer*>(srclayers[0])->batchsize();
-  Record sample = dynamic_cast<DataLayer*>(srclayers[0])->sample();
-  vector<int> shape;
-  shape.push_back(batchsize);
-  for (int x : sample.image().shape()) {
-    shape.push_back(x);
-  }
-  CHECK_EQ(shape.size(), 4);
-  if (cropsize_) {
-    shape[2] = cropsize_;
-    shape[3] = cropsize_;
-  }
-  data_.Reshape(shape);
-  mean_.Reshape({shape[1], shape[2], shape[3]});
-  if (proto.rgbimage_conf().has_meanfile()) {
+  // the mean has the shape of the raw image, from which the crop window of
+  // each image is subtracted
+  mean_.Reshape({channels, height, width});
+  channels_ = channels;
+  croph_ = height;
+  cropw_ = width;
+  if (cropsize_)
+    croph_ = cropw_ = cropsize_;
+  data_.Reshape({batchsize, channels_, croph_, cropw_});
+  rngs_.clear();
+  for (int i = 0; i < pool_->size(); i++)
+    rngs_.push_back(std::mt19937(rand()));
+  has_mean_ = proto.rgbimage_conf().has_meanfile();
+  if (has_mean_) {
     if (proto.rgbimage_conf().meanfile().find("binaryproto") != string::npos) {
       CaffeBlob mean;
       ReadProtoFromBinaryFile(proto.rgbimage_conf().meanfile().c_str(), &mean);
@@ -359,6 +616,82 @@ void RGBImageLayer::Setup(const LayerProto& proto,
   }
 }
 
+/*************** Implementation for ImageDecodeLayer ***********************/
+void ImageDecodeLayer::Decode(int tid, const string& buf, int* height,
+    int* width) {
+  vector<uint8_t>* hwc = &decoded_.at(tid);
+  const uint8_t* head = reinterpret_cast<const uint8_t*>(buf.data());
+  if (buf.size() >= 2 && head[0] == 0xFF && head[1] == 0xD8) {
+#ifdef USE_JPEG
+    CHECK(DecodeJPEG(buf, channels_, hwc, height, width))
+      << "Failed to decode JPEG image";
+#else
+    LOG(FATAL) << "JPEG decoding is not enabled, configure with --enable-jpeg";
+#endif
+  } else if (buf.size() >= 4 && head[0] == 0x89 && head[1] == 'P') {
+#ifdef USE_PNG
+    CHECK(DecodePNG(buf, channels_, hwc, height, width))
+      << "Failed to decode PNG image";
+#else
+    LOG(FATAL) << "PNG decoding is not enabled, configure with --enable-png";
+#endif
+  } else {
+    LOG(FATAL) << "Unknown image encoding";
+  }
+  const uint8_t* src = hwc->data();
+  if (resize_height_ > 0 && resize_width_ > 0) {
+    vector<uint8_t>* resized = &resized_.at(tid);
+    resized->resize(resize_height_ * resize_width_ * channels_);
+    ResizeImage(src, *height, *width, channels_, resize_height_,
+        resize_width_, resized->data());
+    *height = resize_height_;
+    *width = resize_width_;
+    src = resized->data();
+  }
+  vector<uint8_t>* chw = &pixels_.at(tid);
+  chw->resize((*height) * (*width) * channels_);
+  HWCToCHW(src, *height, *width, channels_, bgr_, chw->data());
+}
+
+void ImageDecodeLayer::ParseImage(int tid, bool train,
+    const SingleLabelImageRecord& image, float* dst) {
+  if (!image.encoded()) {
+    RGBImageLayer::ParseImage(tid, train, image, dst);
+    return;
+  }
+  int height, width;
+  Decode(tid, image.pixel(), &height, &width);
+  Transform(tid, train, pixels_.at(tid).data(), nullptr, height, width, dst);
+}
+
+void ImageDecodeLayer::Setup(const LayerProto& proto,
+    const vector<Layer*>& srclayers) {
+  ParserLayer::Setup(proto, srclayers);
+  CHECK_EQ(srclayers.size(), 1);
+  const ImageDecodeProto& conf = proto.imagedecode_conf();
+  channels_ = conf.channels();
+  CHECK(channels_ == 1 || channels_ == 3);
+  resize_height_ = conf.resize_height();
+  resize_width_ = conf.resize_width();
+  bgr_ = conf.bgr() && channels_ == 3;
+  decoded_.resize(pool_->size());
+  resized_.resize(pool_->size());
+  pixels_.resize(pool_->size());
+  int batchsize = dynamic_cast<DataLayer*>(srclayers[0])->batchsize();
+  const SingleLabelImageRecord& sample =
+    dynamic_cast<DataLayer*>(srclayers[0])->sample().image();
+  int height, width;
+  if (sample.encoded()) {
+    Decode(0, sample.pixel(), &height, &width);
+  } else {
+    CHECK_EQ(sample.shape_size(), 3);
+    CHECK_EQ(sample.shape(0), channels_);
+    height = sample.shape(1);
+    width = sample.shape(2);
+  }
+  SetupTransform(proto, batchsize, channels_, height, width);
+}
+
 /************* Implementation for PrefetchLayer ***********/
 PrefetchLayer::~PrefetchLayer() {
   if (thread_.joinable())
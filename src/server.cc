@@ -22,7 +22,11 @@
 #include "./server.h"
 
 #include <thread>
+#include <algorithm>
 #include <chrono>
+#include <climits>
+#include <map>
+#include <set>
 #include "mshadow/tensor.h"
 #include "proto/common.pb.h"
 #include "utils/param.h"
@@ -41,23 +45,64 @@ Server::Server(int group_id, int server_id,
     const vector<int>& slice2server) {
   grp_id_ = group_id;
   id_ = server_id;
-  updater_ = Updater::Create(job_conf.updater());
+  nthreads_ = Cluster::Get()->server_threads();
+  CHECK_GT(nthreads_, 0);
+  const auto& codec = Cluster::Get()->grad_codec();
+  // updaters (e.g., learning rate generators) and codecs keep states, hence
+  // each update thread has its own
+  for (int k = 0; k < nthreads_; k++) {
+    updaters_.push_back(Updater::Create(job_conf.updater()));
+    if (codec.type() != kNoCodec || codec.has_user_type())
+      codecs_.push_back(GradCodec::Create(codec));
+  }
+  // SSP updates do not count local updates for syncing with master groups
+  CHECK(Cluster::Get()->staleness() < 0
+      || Cluster::Get()->nserver_groups() <= 1)
+    << "staleness >= 0 requires a single server group";
+  group_sync_ = GroupSync::Create(Cluster::Get()->group_sync(),
+      Cluster::Get()->nserver_groups());
   slice2group_ = slice2group;
   slice2server_ = slice2server;
+  checkpoint_after_ = job_conf.checkpoint_after();
+  checkpoint_freq_ = job_conf.checkpoint_freq();
+  for (const auto& path : job_conf.server_checkpoint_path())
+    checkpoint_paths_.push_back(path);
 }
 
 Server::~Server() {
-  delete updater_;
+  for (auto updater : updaters_)
+    delete updater;
+  for (auto codec : codecs_)
+    delete codec;
+  delete group_sync_;
   // free Params (i.e., slices) in server shard
   for (auto entry : shard_)
-    for (auto param : entry.second->shares)
-      delete param;
+    if (entry != nullptr)
+      for (auto param : entry->shares)
+        delete param;
+  for (auto& requests : pending_requests_)
+    for (auto msg : requests)
+      delete msg;
+  for (auto& clock : clocks_)
+    for (auto msg : clock.waiting)
+      delete msg;
+  for (auto& requests : sync_requests_)
+    for (auto msg : requests)
+      delete msg;
+  for (auto& entry : restored_)
+    delete entry.second;
 }
 
 void Stop(void* running) {
   *static_cast<bool *>(running) = false;
 }
 
+inline void Enqueue(UpdateQueue* queue, Msg* msg) {
+  while (!queue->ring.Push(msg))
+    std::this_thread::yield();
+  queue->bell.Ring();
+}
+
 void Server::Run() {
   LOG(ERROR) << "Server (group = " << grp_id_ <<", id = " << id_ << ") start";
   auto cluster = Cluster::Get();
@@ -70,63 +115,129 @@ void Server::Run() {
   n_updates_.resize(slice2group_.size(), 0);
   n_pending_sync_.resize(slice2group_.size(), 0);
   last_sync_.resize(slice2group_.size());
+  sync_center_.resize(slice2group_.size());
+  sync_requests_.resize(slice2group_.size());
+  // per-slice states are accessed by the update thread of each slice
+  shard_.resize(slice2group_.size(), nullptr);
+  buffer_requests_.resize(slice2group_.size());
+  pending_requests_.resize(slice2group_.size());
+  sync_residual_.resize(slice2group_.size());
+  clocks_.resize(slice2group_.size());
+  next_checkpoint_.resize(slice2group_.size(), INT_MAX);
+  for (size_t i = 0; i < slice2server_.size(); i++)
+    if (slice2server_[i] == id_)
+      num_checkpoint_slices_++;
+  // slices of this server from checkpoints, to be applied when they are put
+  for (const auto& path : checkpoint_paths_) {
+    vector<SliceSnapshot*> snapshots;
+    ReadSliceSnapshots(path, &snapshots);
+    for (auto snapshot : snapshots) {
+      int slice = snapshot->slice;
+      if (slice < static_cast<int>(slice2server_.size())
+          && slice2server_[slice] == id_ && restored_.count(slice) == 0)
+        restored_[slice] = snapshot;
+      else
+        delete snapshot;
+    }
+  }
+  std::thread checkpointer;
+  if (cluster->server_checkpoint())
+    checkpointer = std::thread(&Server::WriteCheckpoints, this);
 
   // TODO(wangsh): give each dealer a unique id
-  auto dealer = new Dealer(0);
+  auto dealer = new InprocDealer(0);
   CHECK(dealer->Connect(kInprocRouterEndpoint));
   Msg* ping = new Msg(Addr(grp_id_, id_, kServer), Addr(-1, -1, kStub));
   ping->set_type(kConnect);
   dealer->Send(&ping);
+  // slices are hashed to update threads, see Dispatch()
+  std::vector<std::thread> threads;
+  if (nthreads_ > 1) {
+    for (int k = 0; k < nthreads_; k++) {
+      queues_.push_back(new UpdateQueue(kUpdateQueueSize));
+      threads.push_back(std::thread(&Server::RunUpdates, this, queues_[k]));
+    }
+  }
 
   bool running = true;
   CHECK(cluster->runtime()->WatchSGroup(grp_id_, id_, Stop, &running));
-  Poller poll(dealer);
+  // requests on Params of front layers are handled first
+  MsgQueue requests;
   // start recv loop and process requests
   while (running) {
-    // must use poller here; otherwise Receive() gets stuck after workers stop.
-    auto* sock = poll.Wait(cluster->poll_time());
-    if (poll.Terminated()) {
-      LOG(ERROR) << "Connection broken!";
-      exit(0);
-    } else if (sock == nullptr) {
+    if (requests.empty()) {
+      // must time out here; otherwise Receive() gets stuck after workers stop
+      Msg* msg = dealer->Receive(cluster->poll_time());
+      if (zsys_interrupted) {
+        LOG(ERROR) << "Connection broken!";
+        exit(0);
+      } else if (msg == nullptr) {
+        continue;
+      }
+      requests.Push(msg, MsgPriority(msg));
+    }
+    // drain arrived msgs to order them by priority
+    for (Msg* msg = dealer->Receive(0); msg != nullptr;
+        msg = dealer->Receive(0))
+      requests.Push(msg, MsgPriority(msg));
+    Msg* msg = requests.Pop();
+    if (nthreads_ > 1) {
+      if (msg->type() == kBatch) {
+        for (Msg* request : msg->SplitMsgs())
+          Dispatch(request);
+        DeleteMsg(&msg);
+      } else {
+        Dispatch(msg);
+      }
       continue;
     }
-    Msg* msg = dealer->Receive();
-    if (msg == nullptr) break;  // interrupted
-    Msg* response = nullptr;
-    int type = msg->type();
-    int slice_id = SliceID(msg->trgt_val());
-    if (type == kPut) {
-      response = HandlePut(&msg);
-    } else if (shard_.find(slice_id) == shard_.end()) {
-      // TODO(wangsh): buffer the msg instead, and process it after the
-      //               corresponding put request is done
-      // delay the processing by re-queue the msg. May sleep for a while?
-      response = msg;
-    } else {
-      switch (type) {
-        case kGet:
-          response = HandleGet(&msg);
-          break;
-        case kUpdate:
-          for (auto reply : HandleUpdate(&msg))
-            dealer->Send(&reply);
-          break;
-        case kSyncRequest:
-          response = HandleSyncRequest(&msg);
-          break;
-        case kSyncResponse:
-          HandleSyncResponse(&msg);
-          break;
-        default:
-          LOG(ERROR) << "Unknown message type: " << type;
-          break;
+    vector<Msg*> replies;
+    if (msg->type() == kBatch) {
+      for (Msg* request : msg->SplitMsgs())
+        HandleRequest(&request, &replies);
+      DeleteMsg(&msg);
+      // reply in batches, one per dst
+      std::map<int, Msg*> batches;
+      for (Msg* reply : replies) {
+        auto& batch = batches[reply->dst()];
+        if (batch == nullptr) {
+          batch = new Msg(reply->src(), reply->dst());
+          batch->set_type(kBatch);
+          batch->set_trgt(reply->trgt_val(), reply->trgt_version());
+        }
+        batch->AppendMsg(&reply);
       }
+      for (auto& entry : batches)
+        dealer->Send(&entry.second);
+    } else {
+      HandleRequest(&msg, &replies);
+      for (Msg* reply : replies)
+        dealer->Send(&reply);
     }
-    if (response != nullptr)
-      dealer->Send(&response);
   }
 
+  while (!requests.empty()) {
+    Msg* msg = requests.Pop();
+    DeleteMsg(&msg);
+  }
+  for (auto queue : queues_) {
+    Msg* stop = new Msg();
+    stop->set_type(kStop);
+    Enqueue(queue, stop);
+  }
+  for (auto& thread : threads)
+    thread.join();
+  for (auto queue : queues_)
+    delete queue;
+  queues_.clear();
+  if (checkpointer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(snapshot_mutex_);
+      snapshots_.push(nullptr);
+    }
+    snapshot_cv_.notify_one();
+    checkpointer.join();
+  }
   // send stop msg to stub
   Msg* msg = new Msg(Addr(grp_id_, id_, kServer), Addr(-1, -1, kStub));
   msg->set_type(kStop);
@@ -136,15 +247,89 @@ void Server::Run() {
   delete dealer;
 }
 
+void Server::Dispatch(Msg* msg) {
+  Enqueue(queues_.at(SliceID(msg->trgt_val()) % nthreads_), msg);
+}
+
+void Server::RunUpdates(UpdateQueue* queue) {
+  // replies are sent to the stub directly, not via the Run() thread
+  InprocDealer dealer;
+  CHECK(dealer.Connect(kInprocRouterEndpoint, false));
+  while (true) {
+    Msg* msg = nullptr;
+    queue->bell.Wait([queue, &msg]() { return queue->ring.Pop(&msg); });
+    if (msg->type() == kStop) {
+      DeleteMsg(&msg);
+      break;
+    }
+    vector<Msg*> replies;
+    HandleRequest(&msg, &replies);
+    for (Msg* reply : replies)
+      dealer.Send(&reply);
+  }
+}
+
+void Server::HandleRequest(Msg** msg, vector<Msg*>* replies) {
+  Msg* response = nullptr;
+  int type = (*msg)->type();
+  int slice_id = SliceID((*msg)->trgt_val());
+  bool updated = false;
+  if (type == kPut) {
+    response = HandlePut(msg);
+  } else if (shard_.at(slice_id) == nullptr) {
+    // park the request until the slice is put
+    pending_requests_[slice_id].push_back(*msg);
+    *msg = nullptr;
+  } else {
+    auto param = shard_.at(slice_id)->shares.at(0);
+    int version = param->local_version();
+    switch (type) {
+      case kGet:
+        response = HandleGet(msg);
+        break;
+      case kUpdate:
+        for (auto reply : HandleUpdate(msg))
+          replies->push_back(reply);
+        updated = param->local_version() != version;
+        if (param->local_version() >= next_checkpoint_[slice_id])
+          SnapshotSlice(slice_id);
+        break;
+      case kSyncRequest:
+        for (auto reply : HandleSyncRequest(msg))
+          replies->push_back(reply);
+        break;
+      case kSyncResponse:
+        HandleSyncResponse(msg);
+        break;
+      default:
+        LOG(ERROR) << "Unknown message type: " << type;
+        break;
+    }
+  }
+  if (response != nullptr)
+    replies->push_back(response);
+  // serve requests waiting for the slice to be put or updated
+  if (type == kPut || updated)
+    HandlePendingRequests(slice_id, replies);
+}
+
+void Server::HandlePendingRequests(int slice_id, vector<Msg*>* replies) {
+  vector<Msg*> requests;
+  requests.swap(pending_requests_.at(slice_id));
+  for (Msg* request : requests)
+    HandleRequest(&request, replies);
+}
+
 Msg* Server::HandlePut(Msg **msg) {
   int version = (*msg)->trgt_version();
   int slice_id = SliceID((*msg)->trgt_val());
-  if (shard_.find(slice_id) != shard_.end())
+  if (shard_.at(slice_id) != nullptr)
     LOG(FATAL) << "Param (" << slice_id << ") is put more than once";
 
   // TODO(wangwei) replace hard coded param type 0
   auto  param = Singleton<Factory<Param>>::Instance()->Create(0);
   auto response = param->HandlePutMsg(msg, true);
+  param->set_codec(SliceCodec(slice_id));
   // parse num of shares of this param from a worker group
   int num_shares = 1;
   if ((*msg)->NextFrame())
@@ -155,10 +340,33 @@ Msg* Server::HandlePut(Msg **msg) {
   param->set_version(version);
   param->set_local_version(version);
   param->set_id(slice_id);
+  // restore values and updater states from the server checkpoint
+  auto restored = restored_.find(slice_id);
+  // workers do not Put values of master slices when resuming from it
+  if (checkpoint_paths_.size() && slice2group_[slice_id] == grp_id_)
+    CHECK(restored != restored_.end())
+      << "slice " << slice_id << " is not in the server checkpoint";
+  if (restored != restored_.end()) {
+    auto snapshot = restored->second;
+    CHECK_EQ(static_cast<int>(snapshot->data.size()), param->size())
+      << "slice " << slice_id;
+    memcpy(param->mutable_cpu_data(), snapshot->data.data(),
+        param->size() * sizeof(float));
+    if (snapshot->history.size())
+      memcpy(param->mutable_cpu_history(), snapshot->history.data(),
+          param->size() * sizeof(float));
+    param->set_version(snapshot->version);
+    param->set_local_version(snapshot->version);
+  }
+  if (Cluster::Get()->server_checkpoint())
+    next_checkpoint_[slice_id] = NextCheckpoint(param->local_version());
   // allocate blob for param sync between groups.
   if (slice2group_[slice_id] != grp_id_) {
     last_sync_[slice_id].ReshapeLike(param->data());
     last_sync_[slice_id].CopyFrom(param->data());
+  } else if (Cluster::Get()->nserver_groups() > 1) {
+    sync_center_[slice_id].ReshapeLike(param->data());
+    sync_center_[slice_id].CopyFrom(param->data());
   }
   LOG(INFO) << "server (group = " << grp_id_ << ", id = " << id_
             <<") put slice=" << slice_id << " size=" << param->size();
@@ -168,18 +376,22 @@ Msg* Server::HandlePut(Msg **msg) {
 Msg* Server::HandleGet(Msg **msg) {
   int val = (*msg)->trgt_val();
   auto param = shard_.at(SliceID(val))->shares.at(0);
-  // re-queue the request if the param is not updated to the required version
-  if (param->version() < (*msg)->trgt_version()) {
-    return *msg;
+  // park the request until the param is updated to the required version
+  if (param->local_version() < (*msg)->trgt_version()) {
+    pending_requests_[SliceID(val)].push_back(*msg);
+    *msg = nullptr;
+    return nullptr;
   } else {
     // LOG(ERROR) << "get " << slice << " from "<<(*msg)->src_first();
     auto reply = param->HandleGetMsg(msg, false);
-    reply->set_trgt(val, param->version());
+    reply->set_trgt(val, param->local_version());
     return reply;
   }
 }
 
 const vector<Msg*> Server::HandleUpdate(Msg **msg) {
+  if (Cluster::Get()->staleness() >= 0)
+    return HandleStaleUpdate(msg);
   vector<Msg*> ret;
   int sliceid = SliceID((*msg)->trgt_val());
   auto entry = shard_.at(sliceid);
@@ -200,7 +412,7 @@ const vector<Msg*> Server::HandleUpdate(Msg **msg) {
     auto param = entry->shares.at(0);
     // extract and aggregate gradients
     param->ParseUpdateMsgs(request);
-    updater_->Update(step, param, 1.0f / entry->num_total);
+    SliceUpdater(sliceid)->Update(step, param, 1.0f / entry->num_total);
     param->set_local_version(param->local_version() + 1);
     // response to all shares of this param
     for (auto response : param->GenUpdateResponseMsgs(&request, false)) {
@@ -214,16 +426,31 @@ const vector<Msg*> Server::HandleUpdate(Msg **msg) {
     if (slice2group_[sliceid] != grp_id_
         && n_updates_[sliceid] >= Cluster::Get()->sync_freq()
         && n_pending_sync_[sliceid] <= Cluster::Get()->sync_freq()) {
-      auto shape = Shape1(param->size());
-      Tensor<cpu, 1> tmp(last_sync_[sliceid].mutable_cpu_data(), shape);
-      Tensor<cpu, 1> cur(param->mutable_cpu_data(), shape);
-      tmp = cur - tmp;
+      vector<float> payload(param->size());
+      group_sync_->GenRequest(param->size(), param->mutable_cpu_data(),
+          last_sync_[sliceid].mutable_cpu_data(), payload.data());
       int addr = Addr(slice2group_[sliceid], slice2server_[sliceid], kServer);
       Msg* sync = new Msg(Addr(grp_id_, id_, kServer), addr);
       sync->set_type(kSyncRequest);
       sync->set_trgt(trgt_val, param->local_version());
-      sync->AddFrame(tmp.dptr, param->size() * sizeof(float));
-      Copy(tmp, cur);
+      // only differences are compressed like gradients
+      auto codec = SliceCodec(sliceid);
+      if (codec != nullptr && group_sync_->diff_payload()) {
+        float* residual = nullptr;
+        if (codec->error_feedback()) {
+          auto& blob = sync_residual_[sliceid];
+          if (blob.count() == 0)
+            blob.Reshape(vector<int>{param->size()});
+          residual = blob.mutable_cpu_data();
+        }
+        std::string buf;
+        codec->Encode(payload.data(), param->size(), residual, &buf);
+        sync->AddFormatFrame("i", codec->type());
+        sync->AddFrame(buf.data(), buf.size());
+      } else {
+        sync->AddFormatFrame("i", kNoCodec);
+        sync->AddFrame(payload.data(), param->size() * sizeof(float));
+      }
       ret.push_back(sync);
       n_updates_[sliceid] = 0;
       n_pending_sync_[sliceid]++;
@@ -234,21 +461,129 @@ const vector<Msg*> Server::HandleUpdate(Msg **msg) {
   return ret;
 }
 
-Msg* Server::HandleSyncRequest(Msg **msg) {
-  Msg* msgg = *msg;
-  int slice = SliceID(msgg->trgt_val());
+void SliceClock::Tick(Msg* request, int shares) {
+  int src = request->src();
+  if (clocks.find(src) == clocks.end())
+    num_shares += shares;
+  clocks[src] = request->trgt_version() + 1;
+  waiting.push_back(request);
+}
+
+int SliceClock::Slowest(int num_total) const {
+  if (num_shares < num_total)
+    return -1;
+  int slowest = INT_MAX;
+  for (auto& sender : clocks)
+    slowest = std::min(slowest, sender.second);
+  return slowest;
+}
+
+vector<Msg*> SliceClock::Release(int version, int staleness) {
+  vector<Msg*> released, held;
+  for (Msg* request : waiting) {
+    if (request->trgt_version() + 1 - staleness > version)
+      held.push_back(request);
+    else
+      released.push_back(request);
+  }
+  waiting.swap(held);
+  return released;
+}
+
+const vector<Msg*> Server::HandleStaleUpdate(Msg **msg) {
+  vector<Msg*> ret;
+  int sliceid = SliceID((*msg)->trgt_val());
+  auto entry = shard_.at(sliceid);
+  auto param = entry->shares.at(0);
+  auto& clock = clocks_.at(sliceid);
+  int num_update, step = (*msg)->trgt_version();
+  (*msg)->LastFrame();
+  (*msg)->ParseFormatFrame("i", &num_update);
+  (*msg)->FirstFrame();
+  // apply the gradients (summed over num_update shares) right away
+  param->ParseUpdateMsgs(vector<Msg*>{*msg});
+  SliceUpdater(sliceid)->Update(step, param, 1.0f / entry->num_total);
+  clock.Tick(*msg, num_update);
+  *msg = nullptr;
+  // the slice version is the clock of the slowest sender, which is unknown
+  // until requests from all shares have arrived
+  int slowest = clock.Slowest(entry->num_total);
+  if (slowest > param->local_version())
+    param->set_local_version(slowest);
+  // release responses to senders within the staleness bound
+  for (Msg* request : clock.Release(param->local_version(),
+        Cluster::Get()->staleness())) {
+    int trgt_val = request->trgt_val();
+    int next_step = request->trgt_version() + 1;
+    vector<Msg*> requests{request};
+    for (auto response : param->GenUpdateResponseMsgs(&requests, false)) {
+      response->set_trgt(trgt_val, next_step);
+      ret.push_back(response);
+    }
+  }
+  return ret;
+}
+
+const float* Server::ParseSyncPayload(Msg* msg, int slice_id, int n,
+    vector<float>* decoded) {
+  int codec_type;
+  msg->ParseFormatFrame("i", &codec_type);
+  CHECK(msg->NextFrame());
+  if (codec_type == kNoCodec) {
+    CHECK_EQ(msg->FrameSize(), n * sizeof(float));
+    return static_cast<float*>(msg->FrameData());
+  }
+  auto codec = SliceCodec(slice_id);
+  CHECK(codec != nullptr && codec_type == codec->type())
+    << "unknown gradient codec " << codec_type;
+  decoded->resize(n, 0.f);
+  codec->Decode(static_cast<char*>(msg->FrameData()), msg->FrameSize(),
+      n, 1.f, decoded->data());
+  return decoded->data();
+}
+
+const vector<Msg*> Server::HandleSyncRequest(Msg **msg) {
+  vector<Msg*> ret;
+  int slice = SliceID((*msg)->trgt_val());
   auto param = shard_.at(slice)->shares.at(0);
-  auto shape = Shape1(param->size());
-  CHECK_EQ(msgg->FrameSize(), param->size()*sizeof(float));
-  Tensor<cpu, 1> inc(static_cast<float*>(msgg->FrameData()), shape);
-  Tensor<cpu, 1> cur(param->mutable_cpu_data(), shape);
-  // recv sync msg on the slice I am maintaining
-  cur += inc;
-  msgg->SwapAddr();
-  msgg->set_type(kSyncResponse);
-  // copy the fresh param value into the response msg
-  Copy(inc, cur);
-  return msgg;
+  int n = param->size();
+  auto& held = sync_requests_.at(slice);
+  held.push_back(*msg);
+  *msg = nullptr;
+  // a round merges the earliest held request of each of round_size() groups
+  size_t round_size = group_sync_->round_size();
+  vector<Msg*> round, rest;
+  std::set<int> groups;
+  for (Msg* request : held) {
+    if (round.size() < round_size
+        && groups.insert(AddrGrp(request->src())).second)
+      round.push_back(request);
+    else
+      rest.push_back(request);
+  }
+  if (round.size() < round_size)
+    return ret;
+  held.swap(rest);
+  // recv sync msgs on the slice I am maintaining
+  vector<vector<float>> decoded(round.size());
+  vector<vector<float>> replies(round.size(), vector<float>(n));
+  vector<const float*> payloads;
+  vector<float*> responses;
+  for (size_t k = 0; k < round.size(); k++) {
+    payloads.push_back(ParseSyncPayload(round[k], slice, n, &decoded[k]));
+    responses.push_back(replies[k].data());
+  }
+  group_sync_->Merge(n, payloads, param->mutable_cpu_data(),
+      sync_center_[slice].mutable_cpu_data(), responses);
+  for (size_t k = 0; k < round.size(); k++) {
+    Msg* response = new Msg(round[k]->dst(), round[k]->src());
+    response->set_type(kSyncResponse);
+    response->set_trgt(round[k]->trgt_val(), round[k]->trgt_version());
+    response->AddFrame(replies[k].data(), n * sizeof(float));
+    DeleteMsg(&round[k]);
+    ret.push_back(response);
+  }
+  return ret;
 }
 
 // recv sync msg on slice mastered by others
@@ -256,14 +591,83 @@ void Server::HandleSyncResponse(Msg **msg) {
   Msg* msgg = *msg;
   int slice = SliceID(msgg->trgt_val());
   auto param = shard_.at(slice)->shares.at(0);
-  auto shape = Shape1(param->size());
-  Tensor<cpu, 1> prev(last_sync_[param->id()].mutable_cpu_data(), shape);
-  Tensor<cpu, 1> cur(param->mutable_cpu_data(), shape);
-  Tensor<cpu, 1> master(static_cast<float*>(msgg->FrameData()), shape);
-  cur += master - prev;  // cur = master + (cur - prev);
-  Copy(prev, cur);
+  CHECK_EQ(msgg->FrameSize(), param->size() * sizeof(float));
+  group_sync_->ParseResponse(param->size(),
+      static_cast<float*>(msgg->FrameData()), param->mutable_cpu_data(),
+      last_sync_[slice].mutable_cpu_data());
   DeleteMsg(msg);
   n_pending_sync_[slice]--;
 }
 
+int Server::NextCheckpoint(int version) const {
+  if (checkpoint_freq_ <= 0)
+    return INT_MAX;
+  if (version < checkpoint_after_)
+    return checkpoint_after_;
+  return checkpoint_after_
+    + ((version - checkpoint_after_) / checkpoint_freq_ + 1) * checkpoint_freq_;
+}
+
+void Server::SnapshotSlice(int slice_id) {
+  auto param = shard_.at(slice_id)->shares.at(0);
+  auto snapshot = new SliceSnapshot();
+  snapshot->slice = slice_id;
+  snapshot->version = next_checkpoint_[slice_id];
+  // other slices only mark the step as reached by this server
+  if (slice2group_[slice_id] == grp_id_) {
+    const float* data = param->mutable_cpu_data();
+    snapshot->data.assign(data, data + param->size());
+    const float* history = param->mutable_cpu_history();
+    snapshot->history.assign(history, history + param->size());
+  }
+  // in the SSP mode the version may pass more than one checkpoint step
+  next_checkpoint_[slice_id] = NextCheckpoint(param->local_version());
+  {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    snapshots_.push(snapshot);
+  }
+  snapshot_cv_.notify_one();
+}
+
+void Server::WriteCheckpoints() {
+  // checkpoint step -> snapshots of this server at that step
+  std::map<int, vector<SliceSnapshot*>> steps;
+  std::string folder = Cluster::Get()->checkpoint_folder();
+  while (true) {
+    SliceSnapshot* snapshot = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(snapshot_mutex_);
+      snapshot_cv_.wait(lock, [this]() { return !snapshots_.empty(); });
+      snapshot = snapshots_.front();
+      snapshots_.pop();
+    }
+    if (snapshot == nullptr)
+      break;
+    int step = snapshot->version;
+    auto& snapshots = steps[step];
+    snapshots.push_back(snapshot);
+    if (static_cast<int>(snapshots.size()) < num_checkpoint_slices_)
+      continue;
+    // servers without master slices write empty files, which tell the
+    // driver that they have reached the step, see Driver::SetupForResume()
+    vector<SliceSnapshot*> masters;
+    for (auto ptr : snapshots)
+      if (slice2group_[ptr->slice] == grp_id_)
+        masters.push_back(ptr);
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s/step%d-server%d-%d", folder.c_str(), step,
+        grp_id_, id_);
+    if (WriteSliceSnapshots(buf, step, masters))
+      LOG(INFO) << "checkpoint to " << buf;
+    for (auto ptr : snapshots)
+      delete ptr;
+    steps.erase(step);
+  }
+  for (auto& entry : steps) {
+    LOG(WARNING) << "drop incomplete checkpoint of step " << entry.first;
+    for (auto ptr : entry.second)
+      delete ptr;
+  }
+}
+
 }  // namespace singa
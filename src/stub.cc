@@ -40,14 +40,41 @@ using std::string;
 /***********************Stub****************************/
 Stub::~Stub() {
   delete router_;
+  delete remote_router_;
+  delete sum_pool_;
+  for (auto codec : codecs_)
+    delete codec;
 }
 void Stub::Setup() {
-  router_ = new Router();
-  router_->Bind(kInprocRouterEndpoint);
+  router_ = new InprocRouter();
+  CHECK(router_->Bind(kInprocRouterEndpoint));
+  remote_router_ = new Router();
   auto cluster = Cluster::Get();
   const string hostip = cluster->hostip();
-  int port = router_->Bind("tcp://" + hostip + ":*");
+  int port = remote_router_->Bind("tcp://" + hostip + ":*");
   endpoint_ = hostip + ":" + std::to_string(port);
+  nhandlers_ = cluster->stub_threads();
+  CHECK_GT(nhandlers_, 0);
+  sum_pool_ = new ThreadPool(nhandlers_);
+  const auto& codec = cluster->grad_codec();
+  if (codec.type() != kNoCodec || codec.has_user_type())
+    for (int k = 0; k < nhandlers_; k++)
+      codecs_.push_back(GradCodec::Create(codec));
+}
+
+void Stub::ForwardRemoteMsgs() {
+  // remote_router_ is used only by this thread, as msgs to other procs are
+  // sent via inter-procs dealers
+  InprocDealer dealer;
+  CHECK(dealer.Connect(kInprocRouterEndpoint, false));
+  Poller poll(remote_router_);
+  int timeout = Cluster::Get()->poll_time();
+  while (forwarding_) {
+    if (poll.Wait(timeout) == nullptr)
+      continue;
+    Msg* msg = remote_router_->Receive();
+    dealer.Send(&msg);
+  }
 }
 /**
  * Get a hash id for a Param object from a group.
@@ -58,11 +85,91 @@ void Stub::Setup() {
 inline int Hash(int grp_id, int param_id) {
   return grp_id * 997 + param_id;
 }
-const std::unordered_map<int, ParamEntry*>  CreateParamShard(
-    const vector<Worker*>& workers) {
+
+/**
+ * @return num of worker groups whose Params share one ParamEntry; with
+ * aggregate_local_groups, the local groups subscribing to the same server
+ * group do
+ */
+inline int GrpsPerEntry() {
+  auto cluster = Cluster::Get();
+  if (!cluster->aggregate_local_groups())
+    return 1;
+  return cluster->nworker_groups_per_server_group();
+}
+
+/**
+ * Worker group under which the Params of a group are aggregated, i.e., the
+ * first group of its ParamEntry.
+ */
+inline int EntryGrp(int grp_id, int grps_per_entry) {
+  return grp_id / grps_per_entry * grps_per_entry;
+}
+
+inline int EntryGrp(int grp_id) {
+  return EntryGrp(grp_id, GrpsPerEntry());
+}
+
+/**
+ * Hash id of the ParamEntry that a Param msg is about.
+ */
+inline int Hash(const Msg* msg) {
+  int type = msg->type();
+  // responses are addressed to the stub of the requesting group
+  int grp = (type == kRGet || type == kRUpdate) ? AddrGrp(msg->dst())
+    : AddrGrp(msg->src());
+  return Hash(EntryGrp(grp), ParamID(msg->trgt_val()));
+}
+
+int Stub::Dispatch(const Msg* msg) const {
+  return Hash(msg) % nhandlers_;
+}
+
+void Stub::HandleParamMsgs(InprocDealer* dealer) {
+  while (true) {
+    Msg* msg = dealer->Receive();
+    if (msg->type() == kStop) {
+      DeleteMsg(&msg);
+      break;
+    }
+    for (Msg* out : HandleParamMsg(&msg))
+      dealer->Send(&out);
+  }
+}
+
+const vector<Msg*> Stub::HandleParamMsg(Msg** msg) {
+  ParamEntry* entry = shard_.at(Hash(*msg));
+  int type = (*msg)->type();
+  vector<Msg*> ret;
+  switch (type) {
+    case kUpdate:
+      ret = HandleUpdateRequest(entry, msg);
+      break;
+    case kRUpdate:
+      HandleUpdateResponse(entry, msg);
+      break;
+    case kGet:
+      ret = HandleGetRequest(entry, msg);
+      break;
+    case kRGet:
+      HandleGetResponse(entry, msg);
+      break;
+    case kPut:
+      ret = HandlePutRequest(entry, msg);
+      break;
+    default:
+      LOG(ERROR) << "Unknow message type:" << type;
+      DeleteMsg(msg);
+      break;
+  }
+  return ret;
+}
+const std::unordered_map<int, ParamEntry*> CreateParamShard(
+    const vector<Worker*>& workers, int grps_per_entry) {
   std::unordered_map<int, ParamEntry*> shard;
-  // grp id -> net
-  std::unordered_map<int, NeuralNet*> grp2net;
+  // grp id -> net, ordered to make the first share of an aggregated entry
+  // come from its first local grp, which puts the Param if it is an owner
+  std::map<int, NeuralNet*> grp2net;
   // grp id -> worker id range
   std::unordered_map<int, std::pair<int, int>> grp2workers;
   for (auto worker : workers) {
@@ -82,13 +189,17 @@ const std::unordered_map<int, ParamEntry*>  CreateParamShard(
   for (const auto entry : grp2net) {
     int grp = entry.first;
     int wstart = grp2workers[grp].first, wend = grp2workers[grp].second;
+    std::set<int> added;  // entries having Params of this grp
     for (auto layer : entry.second->layers()) {
       int partition = layer->partition_id();
       bool local =  partition >= wstart && partition < wend;
       for (auto param : layer->GetParams()) {
-        int hash = Hash(grp, param->owner());
+        int hash = Hash(EntryGrp(grp, grps_per_entry), param->owner());
         if (shard.find(hash) == shard.end())
           shard[hash] = new ParamEntry();
+        else if (added.find(hash) == added.end())
+          shard[hash]->num_groups++;
+        added.insert(hash);
         shard[hash]->AddParam(local, param);
       }
     }
@@ -103,16 +214,51 @@ void Stub::Run(const vector<int>& slice2server,
   auto cluster = Cluster::Get();
   int procs_id = cluster->procs_id();
   LOG(INFO) << "Stub in process " << procs_id << " starts";
-  auto shard = CreateParamShard(workers);
+  shard_ = CreateParamShard(workers, GrpsPerEntry());
+  // update msgs are generated from the first share of each entry, by the
+  // handler thread of that entry
+  if (codecs_.size())
+    for (auto& entry : shard_)
+      entry.second->shares.at(0)->set_codec(
+          codecs_.at(entry.first % nhandlers_));
+  // handler threads receive msgs via their dealers, see Dispatch()
+  vector<InprocDealer*> handler_dealers;
+  vector<std::thread> handlers;
+  if (nhandlers_ > 1) {
+    for (int k = 0; k < nhandlers_; k++) {
+      auto dealer = new InprocDealer();
+      CHECK(dealer->Connect(kInprocRouterEndpoint, false));
+      handler_dealers.push_back(dealer);
+      handlers.push_back(std::thread(&Stub::HandleParamMsgs, this, dealer));
+    }
+  }
   std::map<int, Dealer*> inter_dealers;  // for sending msg to other procs
-  std::queue<Msg*> msg_queue;
+  // msgs on Params of front layers are handled (and forwarded) first
+  MsgQueue msg_queue;
+  // server addr -> msg coalescing small requests to that server
+  std::map<int, Msg*> batches;
+  int batch_bytes = cluster->batch_msg_bytes();
+  forwarding_ = true;
+  std::thread forwarder(&Stub::ForwardRemoteMsgs, this);
   while (true) {
+    // drain arrived msgs to order them by priority
+    for (Msg* msg = router_->Receive(0); msg != nullptr;
+        msg = router_->Receive(0))
+      msg_queue.Push(msg, MsgPriority(msg));
     Msg* msg = nullptr;
-    if (msg_queue.empty()) {
+    if (msg_queue.empty() && batches.size()) {
+      msg = router_->Receive(cluster->batch_msg_wait());
+      if (msg == nullptr) {
+        // no more requests within the window, send out the batches
+        for (auto& entry : batches)
+          msg_queue.Push(entry.second, MsgPriority(entry.second));
+        batches.clear();
+        continue;
+      }
+    } else if (msg_queue.empty()) {
       msg = router_->Receive();
     } else {
-      msg = msg_queue.front();
-      msg_queue.pop();
+      msg = msg_queue.Pop();
     }
     int type = msg->type(), dst = msg->dst(), flag = AddrType(dst);
     if (flag == kStub && (AddrProc(dst) == procs_id || AddrGrp(dst) == -1)) {
@@ -125,43 +271,28 @@ void Stub::Run(const vector<int>& slice2server,
         else if (src_flag == kWorkerParam) nworkers--;
         DeleteMsg(&msg);
         if (nworkers == 0 && nservers == 0) break;
+      } else if (type == kBatch) {
+        for (Msg* response : msg->SplitMsgs())
+          msg_queue.Push(response, MsgPriority(response));
+        DeleteMsg(&msg);
+      } else if (nhandlers_ > 1) {
+        router_->Send(&msg, handler_dealers.at(Dispatch(msg))->channel());
       } else {
-        int grp;
-        int paramid = ParamID(msg->trgt_val());
-        ParamEntry *entry = nullptr;
-        switch (type) {
-          case kUpdate:
-            grp = AddrGrp(msg->src());
-            entry = shard.at(Hash(grp, paramid));
-            for (auto update_msg : HandleUpdateRequest(entry, &msg))
-              msg_queue.push(update_msg);
-            break;
-          case kRUpdate:
-            grp = AddrGrp(msg->dst());
-            entry = shard.at(Hash(grp, paramid));
-            HandleUpdateResponse(entry, &msg);
-            break;
-          case kGet:
-            grp = AddrGrp(msg->src());
-            entry = shard.at(Hash(grp, paramid));
-            for (auto get_msg : HandleGetRequest(entry, &msg))
-              msg_queue.push(get_msg);
-            break;
-          case kRGet:
-            grp = AddrGrp(msg->dst());
-            entry = shard.at(Hash(grp, paramid));
-            HandleGetResponse(entry, &msg);
-            break;
-          case kPut:
-            grp = AddrGrp(msg->src());
-            entry = shard.at(Hash(grp, paramid));
-            for (auto put_msg : HandlePutRequest(entry, &msg))
-              msg_queue.push(put_msg);
-            break;
-          default:
-            LOG(ERROR) << "Unknow message type:" << type;
-            break;
-        }
+        for (Msg* out : HandleParamMsg(&msg))
+          msg_queue.Push(out, MsgPriority(out));
+      }
+    } else if (flag == kServer && (type == kGet || type == kUpdate)
+        && msg->size() < batch_bytes) {
+      Msg*& batch = batches[dst];
+      if (batch == nullptr) {
+        batch = new Msg(msg->src(), dst);
+        batch->set_type(kBatch);
+        batch->set_trgt(msg->trgt_val(), msg->trgt_version());
+      }
+      batch->AppendMsg(&msg);
+      if (batch->size() >= batch_bytes) {
+        msg_queue.Push(batch, MsgPriority(batch));
+        batches.erase(dst);
       }
     } else {
       int dst_procs = AddrProc(dst);
@@ -176,6 +307,17 @@ void Stub::Run(const vector<int>& slice2server,
       }
     }
   }
+  for (auto dealer : handler_dealers) {
+    Msg* stop = new Msg();
+    stop->set_type(kStop);
+    router_->Send(&stop, dealer->channel());
+  }
+  for (auto& handler : handlers)
+    handler.join();
+  for (auto dealer : handler_dealers)
+    delete dealer;
+  forwarding_ = false;
+  forwarder.join();
   LOG(ERROR) << "Stub in process " << procs_id << " stops";
   for (auto& entry : inter_dealers)
     delete entry.second;
@@ -197,9 +339,14 @@ Dealer* Stub::CreateInterProcsDealer(int dst_procs) {
 void Stub::GenMsgs(int type, int version, ParamEntry* entry, Msg* msg,
                       vector<Msg*> *ret) {
   int procs_id = Cluster::Get()->procs_id();
-  int src_grp = AddrGrp(msg->src());
+  // aggregated requests are sent on behalf of the first grp, so that servers
+  // see one sender per procs
+  int src_grp = EntryGrp(AddrGrp(msg->src()));
   int dst_grp = src_grp / Cluster::Get()->nworker_groups_per_server_group();
   auto param = entry->shares.at(0);
+  // servers count shares of one worker grp
+  CHECK_EQ(entry->num_total % entry->num_groups, 0);
+  CHECK_EQ(entry->num_local % entry->num_groups, 0);
   for (int idx = 0 ; idx < param->num_slices(); idx++) {
     int slice_id = param->slice_start() + idx;
     int server = slice2server_[slice_id];
@@ -208,12 +355,12 @@ void Stub::GenMsgs(int type, int version, ParamEntry* entry, Msg* msg,
     if (type == kPut) {
       CHECK_GT(entry->num_total, 0);
       new_msg = param->GenPutMsg(dst_procs != procs_id, idx);
-      new_msg->AddFormatFrame("i", entry->num_total);
+      new_msg->AddFormatFrame("i", entry->num_total / entry->num_groups);
     } else if (type == kGet) {
       new_msg = param->GenGetMsg(dst_procs != procs_id, idx);
     } else if (type == kUpdate) {
       new_msg = param->GenUpdateMsg(dst_procs != procs_id, idx);
-      new_msg->AddFormatFrame("i", entry->num_local);
+      new_msg->AddFormatFrame("i", entry->num_local / entry->num_groups);
     } else {
       LOG(FATAL) << "Wrong type";
     }
@@ -224,6 +371,28 @@ void Stub::GenMsgs(int type, int version, ParamEntry* entry, Msg* msg,
   }
 }
 
+void SumLocalGrads(ParamEntry* entry, ThreadPool* pool) {
+  // slices are summed in parallel; gradients of aggregated grps are averaged
+  // to be sent like those of one grp
+  auto param = entry->shares.at(0);
+  auto sum_slices = [entry, param](int tid, int start, int end) {
+    int offset = param->slice_offset(start);
+    auto shape = mshadow::Shape1(param->slice_offset(end - 1)
+        + param->slice_size(end - 1) - offset);
+    auto it = entry->shares.begin();
+    mshadow::Tensor<mshadow::cpu, 1> sum(
+        (*it)->mutable_cpu_grad() + offset, shape);
+    for (++it; it != entry->shares.end(); it++) {
+      mshadow::Tensor<mshadow::cpu, 1> grad(
+          (*it)->mutable_cpu_grad() + offset, shape);
+      sum += grad;
+    }
+    if (entry->num_groups > 1)
+      sum *= 1.0f / entry->num_groups;
+  };
+  pool->ParallelFor(param->num_slices(), sum_slices);
+}
+
 const vector<Msg*> Stub::HandleGetRequest(ParamEntry* entry, Msg** msg) {
   vector<Msg*> ret;
   int version = (*msg)->trgt_version();
@@ -239,16 +408,8 @@ const vector<Msg*> Stub::HandleUpdateRequest(ParamEntry *entry, Msg** msg) {
   vector<Msg*> ret;
   entry->num_update++;
   if (entry->num_update >= entry->num_local) {
-    // average local gradient
-    if (entry->num_local > 1) {
-      auto it = entry->shares.begin();
-      auto shape = mshadow::Shape1((*it)->size());
-      mshadow::Tensor<mshadow::cpu, 1> sum((*it)->mutable_cpu_grad(), shape);
-      for (++it; it != entry->shares.end(); it++) {
-        mshadow::Tensor<mshadow::cpu, 1> grad((*it)->mutable_cpu_grad(), shape);
-        sum += grad;
-      }
-    }
+    if (entry->num_local > 1)
+      SumLocalGrads(entry, sum_pool_);
     int step = (*msg)->trgt_version();
     GenMsgs(kUpdate, step, entry, *msg, &ret);
     entry->num_update = 0;
@@ -265,12 +426,31 @@ const vector<Msg*> Stub::HandlePutRequest(ParamEntry* entry, Msg** msg) {
   return ret;
 }
 
+void FanOutSlice(ParamEntry* entry, int idx, int version) {
+  auto param = entry->shares.at(0);
+  for (auto share : entry->shares) {
+    if (share->mutable_data() == param->mutable_data())
+      continue;
+    memcpy(share->mutable_cpu_data() + param->slice_offset(idx),
+        param->mutable_cpu_data() + param->slice_offset(idx),
+        param->slice_size(idx) * sizeof(float));
+    if (version >= 0)
+      share->set_version(version);
+  }
+}
+
 void Stub::HandleGetResponse(ParamEntry* entry, Msg** msg) {
   int version = (*msg)->trgt_version();
   int sliceid = SliceID((*msg)->trgt_val());
   auto param = entry->shares.at(0);
-  if (param->ParseGetResponseMsg(*msg, sliceid-param->slice_start()))
+  int idx = sliceid - param->slice_start();
+  if (param->ParseGetResponseMsg(*msg, idx)) {
     param->set_version(version);
+  } else {
+    version = -1;
+  }
+  if (entry->num_groups > 1)
+    FanOutSlice(entry, idx, version);
   DeleteMsg(msg);
 }
 
@@ -278,8 +458,14 @@ void Stub::HandleUpdateResponse(ParamEntry* entry, Msg** msg) {
   int version = (*msg)->trgt_version();
   int sliceid = SliceID((*msg)->trgt_val());
   auto param = entry->shares.at(0);
-  if (param->ParseUpdateResponseMsg(*msg, sliceid-param->slice_start()))
+  int idx = sliceid - param->slice_start();
+  if (param->ParseUpdateResponseMsg(*msg, idx)) {
     param->set_version(version);
+  } else {
+    version = -1;
+  }
+  if (entry->num_groups > 1)
+    FanOutSlice(entry, idx, version);
   DeleteMsg(msg);
 }
 }  // namespace singa
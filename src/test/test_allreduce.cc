@@ -0,0 +1,174 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <glog/logging.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "comm/allreduce.h"
+#include "proto/common.pb.h"
+
+using namespace singa;
+
+/**
+ * Forward msgs among the dealers connected to the router, like the stub.
+ */
+void Route(InprocRouter* router, const std::atomic<bool>* stop) {
+  while (!*stop) {
+    Msg* msg = router->Receive(1);
+    if (msg == nullptr)
+      continue;
+    if (msg->type() == kConnect)
+      delete msg;
+    else
+      router->Send(&msg);
+  }
+}
+
+/**
+ * Run func(rank, dealer, addrs) in one thread per member, with msgs routed by
+ * an inproc router.
+ *
+ * @return milliseconds used by the members
+ */
+template<typename Func>
+double RunMembers(const std::string& endpoint, int nranks, Func func) {
+  InprocRouter router;
+  CHECK(router.Bind(endpoint));
+  std::atomic<bool> stop(false);
+  std::thread router_thread(Route, &router, &stop);
+  std::vector<int> addrs;
+  for (int i = 0; i < nranks; i++)
+    addrs.push_back(Addr(i, 0, kWorkerParam));
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> members;
+  for (int i = 0; i < nranks; i++) {
+    members.push_back(std::thread([&endpoint, &addrs, &func, i]() {
+      InprocDealer dealer;
+      CHECK(dealer.Connect(endpoint));
+      // let the router learn the addr, as done by ConnectStub()
+      Msg* ping = new Msg(addrs[i], Addr(-1, -1, kStub));
+      ping->set_type(kConnect);
+      dealer.Send(&ping);
+      func(i, &dealer, addrs);
+    }));
+  }
+  for (auto& member : members)
+    member.join();
+  auto end = std::chrono::steady_clock::now();
+  stop = true;
+  router_thread.join();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Every member sends its buffer to rank 0, which sums them up and sends the
+ * sum back to all, i.e., what a single server does for one Param.
+ */
+void CentralSum(int rank, InprocDealer* dealer, const std::vector<int>& addrs,
+    float* data, int n) {
+  int nranks = addrs.size();
+  if (rank == 0) {
+    for (int k = 1; k < nranks; k++) {
+      Msg* msg = dealer->Receive();
+      msg->FirstFrame();
+      const float* grad = static_cast<const float*>(msg->FrameData());
+      for (int i = 0; i < n; i++)
+        data[i] += grad[i];
+      delete msg;
+    }
+    for (int k = 1; k < nranks; k++) {
+      Msg* msg = new Msg(addrs[0], addrs[k]);
+      msg->set_type(kAllreduce);
+      msg->AddFrame(data, n * sizeof(float));
+      dealer->Send(&msg);
+    }
+  } else {
+    Msg* msg = new Msg(addrs[rank], addrs[0]);
+    msg->set_type(kAllreduce);
+    msg->AddFrame(data, n * sizeof(float));
+    dealer->Send(&msg);
+    msg = dealer->Receive();
+    msg->FirstFrame();
+    memcpy(data, msg->FrameData(), n * sizeof(float));
+    delete msg;
+  }
+}
+
+TEST(RingAllreduceTest, Sum) {
+  // sizes not divisible by, or smaller than, the num of members
+  for (int nranks : {1, 2, 3, 5}) {
+    for (int n : {1, 4, 37}) {
+      std::atomic<int> correct(0);
+      RunMembers("inproc://allreduce", nranks,
+          [nranks, n, &correct](int rank, InprocDealer* dealer,
+            const std::vector<int>& addrs) {
+        RingAllreduce ring(dealer, rank, addrs);
+        std::vector<float> data(n);
+        // two calls to check the chunks of consecutive calls are not mixed
+        for (int call = 0; call < 2; call++) {
+          for (int i = 0; i < n; i++)
+            data[i] = rank * 100 + i + call;
+          ring.Sum(data.data(), n);
+          bool ok = true;
+          for (int i = 0; i < n; i++) {
+            float expected = 100.f * nranks * (nranks - 1) / 2
+              + nranks * (i + call);
+            ok = ok && data[i] == expected;
+          }
+          if (ok)
+            correct++;
+        }
+      });
+      ASSERT_EQ(correct, 2 * nranks) << nranks << " members, " << n;
+    }
+  }
+}
+
+// compares against a central aggregator; not a correctness test, run it by
+// --gtest_also_run_disabled_tests --gtest_filter=*Benchmark. End-to-end
+// jobs are compared by examples/mnist/allreduce_vs_ps.sh
+TEST(RingAllreduceTest, DISABLED_Benchmark) {
+  const int n = 1 << 20, niters = 3;
+  for (int nranks : {2, 4, 8, 16}) {
+    double ring_time = RunMembers("inproc://ring", nranks,
+        [n, niters](int rank, InprocDealer* dealer,
+          const std::vector<int>& addrs) {
+      RingAllreduce ring(dealer, rank, addrs);
+      std::vector<float> data(n, 1.f);
+      for (int iter = 0; iter < niters; iter++)
+        ring.Sum(data.data(), n);
+    });
+    double central_time = RunMembers("inproc://central", nranks,
+        [n, niters](int rank, InprocDealer* dealer,
+          const std::vector<int>& addrs) {
+      std::vector<float> data(n, 1.f);
+      for (int iter = 0; iter < niters; iter++)
+        CentralSum(rank, dealer, addrs, data.data(), n);
+    });
+    LOG(ERROR) << nranks << " members, " << n << " floats: ring allreduce "
+      << ring_time / niters << " ms, central aggregator "
+      << central_time / niters << " ms per sum";
+  }
+}
@@ -0,0 +1,115 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "utils/codec.h"
+
+using namespace singa;
+
+TEST(CodecTest, Half) {
+  ASSERT_EQ(FloatToHalf(1.f), 0x3c00);
+  ASSERT_EQ(FloatToHalf(-2.5f), 0xc100);
+  ASSERT_EQ(FloatToHalf(65504.f), 0x7bff);
+  ASSERT_EQ(FloatToHalf(1e6f), 0x7c00);
+  ASSERT_EQ(FloatToHalf(std::pow(2.f, -24)), 0x0001);
+  ASSERT_EQ(FloatToHalf(std::pow(2.f, -26)), 0x0000);
+  // 1 + 2^-11 is a tie, rounded to the even mantissa
+  ASSERT_EQ(FloatToHalf(1.f + std::pow(2.f, -11)), 0x3c00);
+  ASSERT_EQ(FloatToHalf(1.f + 3 * std::pow(2.f, -11)), 0x3c02);
+  for (float x : {0.f, 1.f, -2.5f, 0.099975586f, 65504.f, 6.1035156e-05f,
+      5.9604645e-08f})
+    ASSERT_EQ(HalfToFloat(FloatToHalf(x)), x);
+  ASSERT_TRUE(std::isinf(HalfToFloat(0x7c00)));
+}
+
+/**
+ * Check that decoded values plus the new residual equal the gradient plus
+ * the old residual, i.e., nothing is lost with error feedback.
+ */
+void CheckErrorFeedback(GradCodec* codec, const std::vector<float>& grad) {
+  int n = grad.size();
+  std::vector<float> residual(n, 0.f), sum(n, 0.f), decoded(n, 0.f);
+  std::string buf;
+  for (int step = 0; step < 3; step++) {
+    std::vector<float> old = residual;
+    codec->Encode(grad.data(), n, residual.data(), &buf);
+    std::fill(decoded.begin(), decoded.end(), 0.f);
+    codec->Decode(buf.data(), buf.size(), n, 1.f, decoded.data());
+    for (int i = 0; i < n; i++) {
+      ASSERT_NEAR(decoded[i] + residual[i], grad[i] + old[i], 1e-5);
+      sum[i] += decoded[i];
+    }
+  }
+  for (int i = 0; i < n; i++)
+    ASSERT_NEAR(sum[i] + residual[i], 3 * grad[i], 1e-5);
+}
+
+TEST(CodecTest, FP16) {
+  CodecProto proto;
+  proto.set_type(kFP16Codec);
+  FP16Codec codec;
+  codec.Init(proto);
+  std::vector<float> grad{0.1f, -0.2f, 0.3333f, 1e-3f, -7.f};
+  std::string buf;
+  codec.Encode(grad.data(), grad.size(), nullptr, &buf);
+  ASSERT_EQ(buf.size(), grad.size() * 2);
+  std::vector<float> decoded(grad.size(), 1.f);
+  codec.Decode(buf.data(), buf.size(), grad.size(), 1.f, decoded.data());
+  for (size_t i = 0; i < grad.size(); i++)
+    ASSERT_NEAR(decoded[i], grad[i] + 1.f, 1e-3 * std::fabs(grad[i]) + 1e-6);
+  CheckErrorFeedback(&codec, grad);
+}
+
+TEST(CodecTest, TopK) {
+  CodecProto proto;
+  proto.set_type(kTopKCodec);
+  proto.set_topk_ratio(0.25);
+  TopKCodec codec;
+  codec.Init(proto);
+  std::vector<float> grad{0.1f, -5.f, 0.3f, 0.f, 2.f, -0.2f, 1.f, 0.5f};
+  std::string buf;
+  codec.Encode(grad.data(), grad.size(), nullptr, &buf);
+  ASSERT_EQ(buf.size(), sizeof(int) + 2 * (sizeof(int) + sizeof(float)));
+  std::vector<float> decoded(grad.size(), 0.f);
+  codec.Decode(buf.data(), buf.size(), grad.size(), 1.f, decoded.data());
+  for (size_t i = 0; i < grad.size(); i++)
+    ASSERT_EQ(decoded[i], (i == 1 || i == 4) ? grad[i] : 0.f);
+  CheckErrorFeedback(&codec, grad);
+}
+
+TEST(CodecTest, Sign) {
+  CodecProto proto;
+  proto.set_type(kSignCodec);
+  SignCodec codec;
+  codec.Init(proto);
+  std::vector<float> grad{1.f, -3.f, 2.f, -2.f, 0.f, 4.f, -1.f, 1.f, -2.f};
+  std::string buf;
+  codec.Encode(grad.data(), grad.size(), nullptr, &buf);
+  ASSERT_EQ(buf.size(), sizeof(float) + 2);
+  std::vector<float> decoded(grad.size(), 0.f);
+  codec.Decode(buf.data(), buf.size(), grad.size(), 1.f, decoded.data());
+  for (size_t i = 0; i < grad.size(); i++)
+    ASSERT_FLOAT_EQ(decoded[i], grad[i] >= 0 ? 16.f / 9 : -16.f / 9);
+  CheckErrorFeedback(&codec, grad);
+}
@@ -22,8 +22,16 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#ifdef USE_JPEG
+#include <stdio.h>
+#include <jpeglib.h>
+#endif
+#ifdef USE_PNG
+#include <png.h>
+#endif
 #include "gtest/gtest.h"
 #include "utils/common.h"
+#include "utils/thread_pool.h"
 
 using std::string;
 using std::vector;
@@ -131,3 +139,185 @@ TEST(CommonTest, TestPartitionSlices) {
   ASSERT_EQ(box_4, PartitionSlices(4, slices));
   ASSERT_EQ(box_8, PartitionSlices(8, slices));
 }
+
+TEST(CommonTest, TestPixelsToFloat) {
+  const int n = 37;
+  uint8_t pixels[n];
+  float mean[n], dst[n];
+  for (int i = 0; i < n; i++) {
+    pixels[i] = static_cast<uint8_t>(i * 7 + 200);
+    mean[i] = i * 0.5f;
+  }
+  PixelsToFloat(pixels, n, mean, 0.5f, 1.0f, dst);
+  for (int i = 0; i < n; i++)
+    ASSERT_FLOAT_EQ((pixels[i] - mean[i]) * 0.5f + 1.0f, dst[i]);
+  PixelsToFloat(pixels, n, nullptr, 1.0f, 0.0f, dst);
+  for (int i = 0; i < n; i++)
+    ASSERT_FLOAT_EQ(static_cast<float>(pixels[i]), dst[i]);
+}
+
+TEST(CommonTest, TestHWCToCHW) {
+  // 2x2 image, pixel values are 10*pixel + channel
+  uint8_t hwc[12], chw[12];
+  for (int i = 0; i < 4; i++)
+    for (int c = 0; c < 3; c++)
+      hwc[i * 3 + c] = static_cast<uint8_t>(i * 10 + c);
+  HWCToCHW(hwc, 2, 2, 3, false, chw);
+  for (int c = 0; c < 3; c++)
+    for (int i = 0; i < 4; i++)
+      ASSERT_EQ(i * 10 + c, chw[c * 4 + i]);
+  HWCToCHW(hwc, 2, 2, 3, true, chw);
+  for (int c = 0; c < 3; c++)
+    for (int i = 0; i < 4; i++)
+      ASSERT_EQ(i * 10 + 2 - c, chw[c * 4 + i]);
+  // a single channel is copied as it is
+  HWCToCHW(hwc, 3, 4, 1, true, chw);
+  for (int i = 0; i < 12; i++)
+    ASSERT_EQ(hwc[i], chw[i]);
+}
+
+TEST(CommonTest, TestResizeImage) {
+  const uint8_t src[4] = {0, 100, 200, 40};
+  const uint8_t up[16] = {
+    0, 25, 75, 100,
+    50, 59, 76, 85,
+    150, 126, 79, 55,
+    200, 160, 80, 40};
+  uint8_t dst[16];
+  ResizeImage(src, 2, 2, 1, 4, 4, dst);
+  for (int i = 0; i < 16; i++)
+    ASSERT_EQ(up[i], dst[i]);
+  // halving averages 2x2 blocks, channels are resized independently
+  uint8_t big[32], small[8];
+  for (int i = 0; i < 16; i++) {
+    big[i * 2] = static_cast<uint8_t>(i * 16);
+    big[i * 2 + 1] = 255;
+  }
+  ResizeImage(big, 4, 4, 2, 2, 2, small);
+  const uint8_t down[4] = {40, 72, 168, 200};
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(down[i], small[i * 2]);
+    ASSERT_EQ(255, small[i * 2 + 1]);
+  }
+}
+
+#ifdef USE_JPEG
+// encode an image of a single RGB color
+static string EncodeJPEG(int height, int width, const uint8_t* rgb) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  unsigned char* buf = nullptr;
+  unsigned long size = 0;  // NOLINT(runtime/int)
+  jpeg_mem_dest(&cinfo, &buf, &size);
+  cinfo.image_height = height;
+  cinfo.image_width = width;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, 100, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  vector<uint8_t> row(width * 3);
+  for (int w = 0; w < width; w++)
+    for (int c = 0; c < 3; c++)
+      row[w * 3 + c] = rgb[c];
+  JSAMPROW ptr = row.data();
+  while (cinfo.next_scanline < cinfo.image_height)
+    jpeg_write_scanlines(&cinfo, &ptr, 1);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  string ret(reinterpret_cast<char*>(buf), size);
+  free(buf);
+  return ret;
+}
+
+TEST(CommonTest, TestDecodeJPEG) {
+  const uint8_t rgb[3] = {200, 100, 50};
+  string buf = EncodeJPEG(8, 16, rgb);
+  vector<uint8_t> hwc;
+  int height, width;
+  ASSERT_TRUE(DecodeJPEG(buf, 3, &hwc, &height, &width));
+  ASSERT_EQ(8, height);
+  ASSERT_EQ(16, width);
+  ASSERT_EQ(8u * 16 * 3, hwc.size());
+  for (size_t i = 0; i < hwc.size(); i++)
+    ASSERT_NEAR(rgb[i % 3], hwc[i], 2);
+  // grayscale pixels are the luminance of the color
+  ASSERT_TRUE(DecodeJPEG(buf, 1, &hwc, &height, &width));
+  ASSERT_EQ(8u * 16, hwc.size());
+  for (auto pixel : hwc)
+    ASSERT_NEAR(0.299 * 200 + 0.587 * 100 + 0.114 * 50, pixel, 2);
+  ASSERT_FALSE(DecodeJPEG("not a jpeg image", 3, &hwc, &height, &width));
+}
+#endif
+
+#ifdef USE_PNG
+TEST(CommonTest, TestDecodePNG) {
+  // 3x4 RGBA image, even pixels are gray, the last one is transparent
+  const int height = 3, width = 4, area = height * width;
+  uint8_t rgba[area * 4];
+  for (int i = 0; i < area; i++) {
+    uint8_t v = static_cast<uint8_t>(i * 20);
+    rgba[i * 4] = v;
+    rgba[i * 4 + 1] = i % 2 ? 255 - v : v;
+    rgba[i * 4 + 2] = i % 2 ? 7 : v;
+    rgba[i * 4 + 3] = i == area - 1 ? 0 : 255;
+  }
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  image.height = height;
+  image.width = width;
+  image.format = PNG_FORMAT_RGBA;
+  png_alloc_size_t size = 0;
+  ASSERT_TRUE(png_image_write_get_memory_size(image, size, 0, rgba, 0,
+        nullptr));
+  string buf(size, '\0');
+  ASSERT_TRUE(png_image_write_to_memory(&image, &buf[0], &size, 0, rgba, 0,
+        nullptr));
+  buf.resize(size);
+
+  vector<uint8_t> hwc;
+  int h, w;
+  ASSERT_TRUE(DecodePNG(buf, 3, &hwc, &h, &w));
+  ASSERT_EQ(height, h);
+  ASSERT_EQ(width, w);
+  ASSERT_EQ(area * 3u, hwc.size());
+  for (int i = 0; i < area - 1; i++)
+    for (int c = 0; c < 3; c++)
+      ASSERT_EQ(rgba[i * 4 + c], hwc[i * 3 + c]);
+  for (int c = 0; c < 3; c++)
+    ASSERT_EQ(0, hwc[(area - 1) * 3 + c]);
+  ASSERT_TRUE(DecodePNG(buf, 1, &hwc, &h, &w));
+  ASSERT_EQ(static_cast<size_t>(area), hwc.size());
+  for (int i = 0; i < area - 1; i += 2)
+    ASSERT_NEAR(rgba[i * 4], hwc[i], 1);
+  ASSERT_FALSE(DecodePNG("not a png image", 3, &hwc, &h, &w));
+}
+#endif
+
+TEST(CommonTest, TestThreadPool) {
+  ThreadPool pool(3);
+  vector<int> count(10, 0);
+  vector<int> tids(10, -1);
+  pool.ParallelFor(10, [&](int tid, int start, int end) {
+    for (int i = start; i < end; i++) {
+      count[i]++;
+      tids[i] = tid;
+    }
+  });
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(1, count[i]);
+    ASSERT_GE(tids[i], 0);
+    ASSERT_LT(tids[i], pool.size());
+  }
+  // fewer items than threads
+  pool.ParallelFor(2, [&](int tid, int start, int end) {
+    for (int i = start; i < end; i++)
+      count[i]++;
+  });
+  ASSERT_EQ(2, count[0]);
+  ASSERT_EQ(2, count[1]);
+  ASSERT_EQ(1, count[2]);
+}
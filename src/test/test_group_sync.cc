@@ -0,0 +1,112 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <vector>
+#include "gtest/gtest.h"
+#include "utils/group_sync.h"
+
+using namespace singa;
+using std::vector;
+
+// run one sync round between a worker group copy and the master copy
+static void SyncOnce(GroupSync* sync, vector<float>* cur, vector<float>* last,
+    vector<float>* master, vector<float>* center) {
+  int n = cur->size();
+  vector<float> payload(n), response(n);
+  sync->GenRequest(n, cur->data(), last->data(), payload.data());
+  sync->Merge(n, vector<const float*>{payload.data()}, master->data(),
+      center->data(), vector<float*>{response.data()});
+  sync->ParseResponse(n, response.data(), cur->data(), last->data());
+}
+
+TEST(GroupSyncTest, Downpour) {
+  DownpourSync sync;
+  sync.Init(GroupSyncProto(), 2);
+  ASSERT_TRUE(sync.diff_payload());
+  ASSERT_EQ(sync.round_size(), 1);
+  vector<float> last{1.f, 2.f}, cur{1.5f, 1.f}, master{3.f, 3.f};
+  vector<float> center(master);
+  SyncOnce(&sync, &cur, &last, &master, &center);
+  // the master adds the local changes and both end up equal
+  ASSERT_FLOAT_EQ(master[0], 3.5f);
+  ASSERT_FLOAT_EQ(master[1], 2.f);
+  ASSERT_EQ(cur, master);
+  ASSERT_EQ(last, cur);
+}
+
+TEST(GroupSyncTest, EASGD) {
+  GroupSyncProto proto;
+  proto.set_type(kEASGDSync);
+  proto.set_alpha(0.5f);
+  EASGDSync sync;
+  sync.Init(proto, 2);
+  ASSERT_FALSE(sync.diff_payload());
+  ASSERT_EQ(sync.round_size(), 1);
+  vector<float> last(1), cur{4.f}, master{0.f};
+  vector<float> center(master);
+  SyncOnce(&sync, &cur, &last, &master, &center);
+  // the local copy moves by 0.5 * (4 - 0) towards the center, which moves
+  // to 2; then the master copy moves by 0.5 * (0 - 2)
+  ASSERT_FLOAT_EQ(cur[0], 2.f);
+  ASSERT_FLOAT_EQ(master[0], 1.f);
+  ASSERT_FLOAT_EQ(center[0], 1.f);
+  ASSERT_EQ(last, cur);
+  // updates of the master group change its copy but not the center
+  master[0] = 9.f;
+  SyncOnce(&sync, &cur, &last, &master, &center);
+  ASSERT_FLOAT_EQ(cur[0], 1.5f);
+  ASSERT_FLOAT_EQ(master[0], 5.25f);
+  ASSERT_FLOAT_EQ(center[0], 5.25f);
+}
+
+TEST(GroupSyncTest, Avg) {
+  AvgSync sync;
+  sync.Init(GroupSyncProto(), 3);
+  ASSERT_EQ(sync.round_size(), 2);
+  int n = 1;
+  vector<float> cur_a{6.f}, last_a(1), cur_b{3.f}, last_b(1), master{0.f};
+  vector<float> center(master), payload_a(n), payload_b(n);
+  vector<float> response_a(n), response_b(n);
+  auto round = [&]() {
+    sync.GenRequest(n, cur_a.data(), last_a.data(), payload_a.data());
+    sync.GenRequest(n, cur_b.data(), last_b.data(), payload_b.data());
+    sync.Merge(n, vector<const float*>{payload_a.data(), payload_b.data()},
+        master.data(), center.data(),
+        vector<float*>{response_a.data(), response_b.data()});
+  };
+  round();
+  sync.ParseResponse(n, response_a.data(), cur_a.data(), last_a.data());
+  sync.ParseResponse(n, response_b.data(), cur_b.data(), last_b.data());
+  // all copies end up at the mean of the three
+  ASSERT_FLOAT_EQ(master[0], 3.f);
+  ASSERT_FLOAT_EQ(cur_a[0], 3.f);
+  ASSERT_FLOAT_EQ(cur_b[0], 3.f);
+  // the master copy changes between syncs and counts as one copy
+  master[0] = 9.f;
+  round();
+  ASSERT_FLOAT_EQ(master[0], 5.f);
+  // local updates made while the request is in flight are kept
+  cur_a[0] += 1.f;
+  sync.ParseResponse(n, response_a.data(), cur_a.data(), last_a.data());
+  sync.ParseResponse(n, response_b.data(), cur_b.data(), last_b.data());
+  ASSERT_FLOAT_EQ(cur_a[0], 6.f);
+  ASSERT_FLOAT_EQ(cur_b[0], 5.f);
+}
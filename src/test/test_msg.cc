@@ -19,8 +19,10 @@
 *
 *************************************************************/
 
+#include <glog/logging.h>
+#include <chrono>
 #include "gtest/gtest.h"
-#include "communication/msg.h"
+#include "comm/msg.h"
 using namespace singa;
 TEST(MsgTest, AddrTest) {
   int src_grp = 1, src_worker = 2;
@@ -100,3 +102,130 @@ TEST(MsgTest, AddFormatFrame) {
   ASSERT_EQ(z, 10.f);
   ASSERT_EQ(p, &x);
 }
+
+TEST(MsgTest, ShortFormatFrame) {
+  Msg msg;
+  msg.AddFormatFrame("i", 12);
+  msg.FirstFrame();
+  int x, y;
+  uint32_t u;
+  // reading past the end of the frame is caught before the read
+  ASSERT_DEATH(msg.ParseFormatFrame("ii", &x, &y), "short format frame");
+  ASSERT_DEATH(msg.ParseFormatFrame("i4", &x, &u), "short format frame");
+  msg.ParseFormatFrame("i", &x);
+  ASSERT_EQ(x, 12);
+}
+
+// timing only, run it by --gtest_also_run_disabled_tests
+TEST(MsgTest, DISABLED_HeaderThroughput) {
+  const int n = 100000;
+  int src = Addr(1, 2, 0), dst = Addr(0, 1, 1);
+  float grad[16];
+  auto start = std::chrono::steady_clock::now();
+  // text header parsed by sscanf, as used before the binary header
+  for (int i = 0; i < n; i++) {
+    zmsg_t* zmsg = zmsg_new();
+    zmsg_addmem(zmsg, grad, sizeof(grad));
+    zmsg_pushstrf(zmsg, "%d %d %d %d %d", src, dst, 3, i, -1);
+    char* tmp = zmsg_popstr(zmsg);
+    int a, b, c, d, e;
+    sscanf(tmp, "%d %d %d %d %d", &a, &b, &c, &d, &e);
+    free(tmp);
+    ASSERT_EQ(d, i);
+    zmsg_destroy(&zmsg);
+  }
+  double text = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    Msg* msg = new Msg(src, dst);
+    msg->set_type(3);
+    msg->set_trgt(i, -1);
+    msg->AddFrame(grad, sizeof(grad));
+    zmsg_t* zmsg = msg->DumpToZmsg();
+    delete msg;
+    msg = new Msg();
+    msg->ParseFromZmsg(zmsg);
+    ASSERT_EQ(msg->src(), src);
+    ASSERT_EQ(msg->dst(), dst);
+    ASSERT_EQ(msg->type(), 3);
+    ASSERT_EQ(msg->trgt_val(), i);
+    ASSERT_EQ(msg->trgt_version(), -1);
+    ASSERT_EQ(msg->FrameSize(), static_cast<int>(sizeof(grad)));
+    delete msg;
+  }
+  double binary = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  Msg msg;
+  msg.AddFormatFrame("iffp", 10, 1.f, 0.5f, grad);
+  for (int i = 0; i < n; i++) {
+    int size;
+    float lr, wd;
+    float* ptr;
+    msg.FirstFrame();
+    msg.ParseFormatFrame("iffp", &size, &lr, &wd, &ptr);
+    ASSERT_EQ(ptr, grad);
+  }
+  double format = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  LOG(INFO) << "msgs/s with text header: " << n / text
+    << ", with binary header: " << n / binary
+    << "; format frames parsed/s: " << n / format;
+}
+
+TEST(MsgTest, AppendMsg) {
+  float grad[3] = {1.f, 2.f, 3.f};
+  Msg batch(Addr(0, 0, 3), Addr(0, 1, 2));
+  batch.set_type(12);
+  for (int i = 0; i < 3; i++) {
+    Msg* msg = new Msg(Addr(i, 0, 3), Addr(0, 1, 2));
+    msg->set_type(i);
+    msg->set_trgt(i, i + 1);
+    msg->AddFormatFrame("i", i);
+    for (int k = 0; k < i; k++)
+      msg->AddFrame(grad, sizeof(grad));
+    batch.AppendMsg(&msg);
+    ASSERT_EQ(msg, nullptr);
+  }
+  auto msgs = batch.SplitMsgs();
+  ASSERT_EQ(msgs.size(), 3u);
+  ASSERT_EQ(batch.size(), 0);
+  for (int i = 0; i < 3; i++) {
+    Msg* msg = msgs[i];
+    ASSERT_EQ(msg->src(), Addr(i, 0, 3));
+    ASSERT_EQ(msg->type(), i);
+    ASSERT_EQ(msg->trgt_val(), i);
+    ASSERT_EQ(msg->trgt_version(), i + 1);
+    int x;
+    msg->ParseFormatFrame("i", &x);
+    ASSERT_EQ(x, i);
+    for (int k = 0; k < i; k++) {
+      ASSERT_TRUE(msg->NextFrame());
+      ASSERT_EQ(static_cast<float*>(msg->FrameData())[2], 3.f);
+    }
+    ASSERT_FALSE(msg->NextFrame());
+    delete msg;
+  }
+}
+
+TEST(MsgTest, MsgQueue) {
+  MsgQueue queue;
+  int priorities[] = {3, 1, 2, 1, 0};
+  for (int i = 0; i < 5; i++) {
+    Msg* msg = new Msg();
+    msg->set_trgt(priorities[i], i);
+    queue.Push(msg, priorities[i]);
+  }
+  ASSERT_EQ(queue.size(), 5u);
+  // ties are popped in the pushing order
+  int order[] = {4, 1, 3, 2, 0};
+  for (int i = 0; i < 5; i++) {
+    Msg* msg = queue.Pop();
+    ASSERT_EQ(msg->trgt_version(), order[i]);
+    delete msg;
+  }
+  ASSERT_TRUE(queue.empty());
+}
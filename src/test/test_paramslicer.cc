@@ -68,3 +68,60 @@ TEST_F(ParamSlicerTest, MultipleBox){
   ASSERT_EQ(slicer.Get(nparams-1).back(), slices.size()-1);
 }
 */
+
+TEST(SliceSnapshotTest, WriteRead) {
+  SliceSnapshot with_history, without_history;
+  with_history.slice = 3;
+  with_history.version = 100;
+  with_history.data = {1.f, 2.f, 3.f};
+  with_history.history = {-1.f, -2.f, -3.f};
+  without_history.slice = 5;
+  without_history.version = 100;
+  without_history.data = {4.f};
+  const std::string path = "src/test/step100-server0-0";
+  ASSERT_TRUE(WriteSliceSnapshots(path, 100,
+        vector<SliceSnapshot*>{&with_history, &without_history}));
+  vector<SliceSnapshot*> snapshots;
+  ASSERT_TRUE(ReadSliceSnapshots(path, &snapshots));
+  ASSERT_EQ(snapshots.size(), 2u);
+  EXPECT_EQ(snapshots[0]->slice, 3);
+  EXPECT_EQ(snapshots[0]->version, 100);
+  EXPECT_EQ(snapshots[0]->data, with_history.data);
+  EXPECT_EQ(snapshots[0]->history, with_history.history);
+  EXPECT_EQ(snapshots[1]->slice, 5);
+  EXPECT_EQ(snapshots[1]->data, without_history.data);
+  EXPECT_TRUE(snapshots[1]->history.empty());
+  for (auto snapshot : snapshots)
+    delete snapshot;
+  // servers without master slices write empty files
+  snapshots.clear();
+  ASSERT_TRUE(WriteSliceSnapshots(path, 100, snapshots));
+  ASSERT_TRUE(ReadSliceSnapshots(path, &snapshots));
+  ASSERT_TRUE(snapshots.empty());
+  remove(path.c_str());
+  // not a checkpoint file
+  ASSERT_FALSE(ReadSliceSnapshots(path, &snapshots));
+}
+
+// update msgs to other procs must not reference the gradient, which the
+// worker overwrites in the next step while zmq may still be sending it
+TEST(ParamTest, CopyUpdateMsg) {
+  Param param;
+  param.Setup(vector<int>{4});
+  param.AddSlice(0, 2);
+  param.AddSlice(1, 2);
+  float* grad = param.mutable_cpu_grad();
+  for (int i = 0; i < 4; i++)
+    grad[i] = i;
+  Msg* msg = param.GenUpdateMsg(true, 1);
+  for (int i = 0; i < 4; i++)
+    grad[i] = -1.f;
+  msg->FirstFrame();
+  msg->NextFrame();
+  ASSERT_EQ(msg->FrameSize(), static_cast<int>(2 * sizeof(float)));
+  const float* frame = static_cast<const float*>(msg->FrameData());
+  EXPECT_NE(frame, grad + 2);
+  EXPECT_EQ(frame[0], 2.f);
+  EXPECT_EQ(frame[1], 3.f);
+  delete msg;
+}
@@ -0,0 +1,74 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <vector>
+#include "gtest/gtest.h"
+#include "comm/msg.h"
+#include "server.h"
+
+using namespace singa;
+using std::vector;
+
+static Msg* UpdateRequest(int src, int step) {
+  Msg* msg = new Msg(src, Addr(0, 0, kServer));
+  msg->set_type(kUpdate);
+  msg->set_trgt(0, step);
+  return msg;
+}
+
+TEST(SliceClockTest, HoldAndRelease) {
+  // stub a sends 1 share, stub b aggregates 2 shares; staleness = 1
+  int a = Addr(0, 0, kStub), b = Addr(1, 0, kStub);
+  const int num_total = 3, staleness = 1;
+  SliceClock clock;
+  int version = 0;
+
+  Msg* a0 = UpdateRequest(a, 0);
+  clock.Tick(a0, 1);
+  ASSERT_EQ(clock.Slowest(num_total), -1);
+  // a may start step 1, which is within the bound of version 0
+  ASSERT_EQ(clock.Release(version, staleness), vector<Msg*>{a0});
+
+  Msg* a1 = UpdateRequest(a, 1);
+  clock.Tick(a1, 1);
+  ASSERT_EQ(clock.Slowest(num_total), -1);
+  // step 2 would be 2 steps ahead of version 0
+  ASSERT_TRUE(clock.Release(version, staleness).empty());
+  ASSERT_EQ(clock.waiting, vector<Msg*>{a1});
+
+  Msg* b0 = UpdateRequest(b, 0);
+  clock.Tick(b0, 2);
+  ASSERT_EQ(clock.num_shares, num_total);
+  version = clock.Slowest(num_total);
+  ASSERT_EQ(version, 1);
+  // b catching up releases a
+  ASSERT_EQ(clock.Release(version, staleness), (vector<Msg*>{a1, b0}));
+  ASSERT_TRUE(clock.waiting.empty());
+
+  // shares of a known sender are counted once
+  Msg* a2 = UpdateRequest(a, 2);
+  clock.Tick(a2, 1);
+  ASSERT_EQ(clock.num_shares, num_total);
+  ASSERT_EQ(clock.Slowest(num_total), 1);
+  ASSERT_TRUE(clock.Release(version, staleness).empty());
+  for (Msg* msg : vector<Msg*>{a0, a1, b0, a2})
+    delete msg;
+}
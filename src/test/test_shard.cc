@@ -20,9 +20,13 @@
 *************************************************************/
 
 #include <sys/stat.h>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 #include "utils/data_shard.h"
+#include "utils/tensor_shard.h"
 
 std::string key[] = {"firstkey",
                      "secondkey",
@@ -83,3 +87,80 @@ TEST(DataShardTest, ReadDataShard) {
   ASSERT_STREQ(key[0].c_str(), k.c_str());
   ASSERT_STREQ(tuple[0].c_str(), t.c_str());
 }
+
+TEST(DataShardTest, SeekToDataShard) {
+  std::string path = "src/test/shard_test";
+  DataShard shard(path, DataShard::kRead, 50);
+  std::string k, t;
+  ASSERT_TRUE(shard.SeekTo(3));
+  ASSERT_TRUE(shard.Next(&k, &t));
+  ASSERT_STREQ(key[3].c_str(), k.c_str());
+  ASSERT_STREQ(tuple[3].c_str(), t.c_str());
+  ASSERT_TRUE(shard.SeekTo(0));
+  ASSERT_TRUE(shard.Next(&k, &t));
+  ASSERT_STREQ(key[0].c_str(), k.c_str());
+  ASSERT_FALSE(shard.SeekTo(5));
+  ASSERT_FALSE(shard.Next(&k, &t));
+}
+
+TEST(DataShardTest, BuildDataShard) {
+  std::string path = "src/test/shard_test/builder";
+  mkdir(path.c_str(), 0755);
+  {
+    DataShardBuilder builder(path, DataShard::kCreate, 64);
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++) {
+      producers.push_back(std::thread([&builder, t] {
+        // every key is inserted by two producers
+        for (int i = 0; i < 100; i++) {
+          int k = (t / 2) * 100 + i;
+          builder.Insert("key" + std::to_string(k),
+                         "tuple" + std::to_string(k));
+        }
+      }));
+    }
+    for (auto& producer : producers)
+      producer.join();
+    ASSERT_EQ(200, builder.count());
+    ASSERT_FALSE(builder.Insert("key0", "tuple0"));
+  }
+  {
+    DataShardBuilder builder(path, DataShard::kAppend);
+    ASSERT_FALSE(builder.Insert("key1", "tuple1"));
+    ASSERT_TRUE(builder.Insert("key200", "tuple200"));
+  }
+  DataShard shard(path, DataShard::kRead, 64);
+  ASSERT_EQ(201, shard.Count());
+  std::set<std::string> keys;
+  std::string k, t;
+  while (shard.Next(&k, &t)) {
+    ASSERT_EQ(k.substr(3), t.substr(5));
+    keys.insert(k);
+  }
+  ASSERT_EQ(201u, keys.size());
+}
+
+TEST(DataShardTest, TensorShard) {
+  std::string path = "src/test/shard_test/tensor";
+  mkdir(path.c_str(), 0755);
+  {
+    TensorShardWriter writer(path, {2, 3}, true);
+    float row[6];
+    for (int i = 0; i < 10; i++) {
+      for (int j = 0; j < 6; j++)
+        row[j] = i * 6 + j;
+      writer.Append(row, i % 3);
+    }
+  }
+  TensorShard shard(path);
+  ASSERT_EQ(10, shard.nrows());
+  ASSERT_EQ(6, shard.rowsize());
+  ASSERT_EQ(std::vector<int>({2, 3}), shard.shape());
+  ASSERT_TRUE(shard.has_label());
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(i * 6, shard.row(i)[0]);
+    ASSERT_EQ(i % 3, *shard.label(i));
+  }
+  // rows are contiguous
+  ASSERT_EQ(59, shard.row(0)[59]);
+}
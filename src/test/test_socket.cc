@@ -0,0 +1,142 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <atomic>
+#include <thread>
+#include "gtest/gtest.h"
+#include "comm/socket.h"
+
+using namespace singa;
+
+TEST(SocketTest, SPSCRing) {
+  SPSCRing<int> ring(5);
+  ASSERT_EQ(ring.capacity(), 8);
+  int x;
+  ASSERT_FALSE(ring.Pop(&x));
+  for (int i = 0; i < 8; i++)
+    ASSERT_TRUE(ring.Push(i));
+  ASSERT_FALSE(ring.Push(8));
+  for (int i = 0; i < 8; i++) {
+    ASSERT_TRUE(ring.Pop(&x));
+    ASSERT_EQ(x, i);
+  }
+  ASSERT_TRUE(ring.empty());
+
+  const int n = 100000;
+  Doorbell bell;
+  std::thread producer([&ring, &bell, n]() {
+    for (int i = 0; i < n; i++) {
+      while (!ring.Push(i))
+        std::this_thread::yield();
+      bell.Ring();
+    }
+  });
+  for (int i = 0; i < n; i++) {
+    bell.Wait([&ring, &x]() { return ring.Pop(&x); });
+    ASSERT_EQ(x, i);
+  }
+  producer.join();
+}
+
+TEST(SocketTest, InprocRouterDealer) {
+  InprocRouter router(4);
+  ASSERT_EQ(router.Bind("inproc://test"), 1);
+  ASSERT_EQ(router.Bind("inproc://test"), 0);
+  int worker = Addr(0, 1, 0), server = Addr(0, 2, 1);
+  // buffered until the worker dealer sends its first msg
+  Msg* msg = new Msg(server, worker);
+  msg->set_type(1);
+  router.Send(&msg);
+  ASSERT_EQ(msg, nullptr);
+  ASSERT_EQ(router.Receive(1), nullptr);
+
+  const int n = 1000;
+  std::atomic<bool> done(false);
+  std::thread thread([worker, server, n, &done]() {
+    InprocDealer dealer(0);
+    ASSERT_EQ(dealer.Connect("inproc://test"), 1);
+    for (int i = 0; i < n; i++) {
+      Msg* msg = new Msg(worker, server);
+      msg->set_trgt(i, i);
+      msg->AddFrame(&i, sizeof(i));
+      dealer.Send(&msg);
+    }
+    Msg* reply = dealer.Receive();
+    ASSERT_EQ(reply->type(), 1);
+    delete reply;
+    // replies sent after the ring is full are kept in order
+    for (int i = 0; i < n; i++) {
+      reply = dealer.Receive();
+      ASSERT_EQ(reply->trgt_val(), i);
+      delete reply;
+    }
+    done = true;
+  });
+  for (int i = 0; i < n; i++) {
+    msg = router.Receive();
+    ASSERT_EQ(msg->src(), worker);
+    ASSERT_EQ(msg->trgt_val(), i);
+    ASSERT_EQ(*static_cast<int*>(msg->FrameData()), i);
+    msg->SwapAddr();
+    router.Send(&msg);
+  }
+  // the router moves queued replies into the ring as the dealer consumes
+  while (!done)
+    ASSERT_EQ(router.Receive(1), nullptr);
+  thread.join();
+}
+
+TEST(SocketTest, InprocRouterSendToChannel) {
+  InprocRouter router(4);
+  ASSERT_EQ(router.Bind("inproc://channel"), 1);
+  // dealers of handler threads do not have their own addresses
+  InprocDealer handlers[2];
+  for (auto& handler : handlers)
+    ASSERT_EQ(handler.Connect("inproc://channel", false), 1);
+  const int n = 10;
+  for (int i = 0; i < n; i++) {
+    Msg* msg = new Msg(Addr(0, 0, 0), Addr(0, 1, 3));
+    msg->set_trgt(i, 0);
+    router.Send(&msg, handlers[i % 2].channel());
+    ASSERT_EQ(msg, nullptr);
+  }
+  std::atomic<int> count(0);
+  std::thread thread([&handlers, &count, n]() {
+    for (int i = 0; i < n / 2; i++) {
+      Msg* msg = handlers[1].Receive();
+      if (msg->trgt_val() == 2 * i + 1)
+        count++;
+      delete msg;
+    }
+  });
+  for (int i = 0; i < n / 2; i++) {
+    // keep flushing queued msgs to both channels
+    ASSERT_EQ(router.Receive(0), nullptr);
+    Msg* msg = handlers[0].Receive();
+    ASSERT_EQ(msg->trgt_val(), 2 * i);
+    delete msg;
+  }
+  // the router flushes the remaining msgs to the other channel
+  while (count < n / 2)
+    ASSERT_EQ(router.Receive(1), nullptr);
+  thread.join();
+  ASSERT_EQ(count, n / 2);
+}
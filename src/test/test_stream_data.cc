@@ -0,0 +1,132 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <czmq.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "neuralnet/input_layer.h"
+
+using namespace singa;
+
+/**
+ * @return serialized Record whose label is the given one
+ */
+std::string LabelRecord(int label) {
+  Record record;
+  record.mutable_image()->set_label(label);
+  std::string str;
+  record.SerializeToString(&str);
+  return str;
+}
+
+//!< bytes that cannot be parsed into a Record, i.e., an incomplete varint
+const std::string kBadRecord("\x08\xff\xff", 3);
+
+LayerProto StreamConf(const std::string& endpoint, int batchsize,
+    int buffer_size, bool bind) {
+  LayerProto proto;
+  proto.set_name("stream");
+  proto.set_type(kStreamData);
+  auto conf = proto.mutable_streamdata_conf();
+  conf->set_endpoint(endpoint);
+  conf->set_batchsize(batchsize);
+  conf->set_buffer_size(buffer_size);
+  conf->set_bind(bind);
+  return proto;
+}
+
+TEST(StreamDataLayerTest, ZMQSource) {
+  const std::string endpoint = "inproc://stream_test";
+  const int n = 20;
+  zsock_t* push = zsock_new(ZMQ_PUSH);
+  ASSERT_NE(zsock_bind(push, "%s", endpoint.c_str()), -1);
+  // sends block until the layer connects and has space in its buffer
+  std::thread sender([push, n]() {
+    for (int i = 0; i < n; i++) {
+      if (i == n / 2) {
+        zframe_t* bad = zframe_new(kBadRecord.data(), kBadRecord.size());
+        zframe_send(&bad, push, 0);
+      }
+      std::string str = LabelRecord(i);
+      zframe_t* frame = zframe_new(str.data(), str.size());
+      zframe_send(&frame, push, 0);
+    }
+  });
+  {
+    // the buffer holds fewer records than sent, hence the receiver waits
+    // for space while records are consumed
+    StreamDataLayer layer;
+    layer.Setup(StreamConf(endpoint, 2, 4, false), vector<Layer*>{});
+    ASSERT_EQ(layer.sample().image().label(), 0);
+    // the bad record is dropped without breaking the order
+    for (int i = 0; i < n; i += 2) {
+      layer.ComputeFeature(kTrain, vector<Layer*>{});
+      ASSERT_EQ(layer.records().size(), 2u);
+      ASSERT_EQ(layer.records()[0].image().label(), i);
+      ASSERT_EQ(layer.records()[1].image().label(), i + 1);
+    }
+  }
+  sender.join();
+  zsock_destroy(&push);
+}
+
+TEST(StreamDataLayerTest, PipeSource) {
+  const std::string path = "src/test/stream_test_pipe";
+  unlink(path.c_str());
+  ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+  const int n = 20;
+  // opening the pipe for writing blocks until the layer opens it
+  std::thread writer([&path, n]() {
+    int fd = open(path.c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    for (int i = 0; i < n; i++) {
+      vector<std::string> tuples{LabelRecord(i)};
+      if (i == n / 2)
+        tuples.insert(tuples.begin(), kBadRecord);
+      for (const auto& str : tuples) {
+        uint32_t len = str.size();
+        ASSERT_EQ(write(fd, &len, sizeof(len)), ssize_t(sizeof(len)));
+        ASSERT_EQ(write(fd, str.data(), len), ssize_t(len));
+      }
+    }
+    close(fd);
+  });
+  {
+    StreamDataLayer layer;
+    layer.Setup(StreamConf(path, 4, 4, true), vector<Layer*>{});
+    ASSERT_EQ(layer.sample().image().label(), 0);
+    for (int i = 0; i < n; i += 4) {
+      layer.ComputeFeature(kTrain, vector<Layer*>{});
+      ASSERT_EQ(layer.records().size(), 4u);
+      for (int k = 0; k < 4; k++)
+        ASSERT_EQ(layer.records()[k].image().label(), i + k);
+    }
+  }
+  writer.join();
+  unlink(path.c_str());
+}
@@ -0,0 +1,141 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include <unordered_map>
+#include <vector>
+#include "gtest/gtest.h"
+#include "stub.h"
+
+using namespace singa;
+using std::vector;
+
+// layer of worker 0 holding one Param of 2 slices, each of 2 floats
+class ParamLayer : public Layer {
+ public:
+  ParamLayer() {
+    LayerProto conf;
+    conf.set_name("param");
+    conf.set_partition_id(0);
+    Layer::Setup(conf, vector<Layer*>{});
+    param_ = new Param();
+    param_->Setup(vector<int>{4});
+    param_->set_id(0);
+    param_->AddSlice(0, 2);
+    param_->AddSlice(1, 2);
+  }
+  ~ParamLayer() { delete param_; }
+  void ComputeFeature(int flag, const vector<Layer*>& srclayers) override {}
+  void ComputeGradient(int flag, const vector<Layer*>& srclayers) override {}
+  const vector<Param*> GetParams() const override {
+    return vector<Param*>{param_};
+  }
+
+ private:
+  Param* param_;
+};
+
+// net of one worker grp, which does not share memory with other grps
+class ParamNet : public NeuralNet {
+ public:
+  ParamNet() : NeuralNet(NetProto(), 1) {
+    layers_.push_back(new ParamLayer());
+  }
+};
+
+class StubTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (int grp = 0; grp < 2; grp++) {
+      nets_.push_back(new ParamNet());
+      workers_.push_back(new BPWorker());
+      workers_.back()->Setup(grp, 0, JobProto(), nets_.back(), nullptr,
+          nullptr);
+    }
+  }
+  void TearDown() override {
+    for (auto& entry : shard_)
+      delete entry.second;
+    for (auto worker : workers_)
+      delete worker;
+    for (auto net : nets_)
+      delete net;
+  }
+  Param* GrpParam(int grp) {
+    return nets_.at(grp)->layers().at(0)->GetParams().at(0);
+  }
+
+  vector<NeuralNet*> nets_;
+  vector<Worker*> workers_;
+  std::unordered_map<int, ParamEntry*> shard_;
+};
+
+TEST_F(StubTest, SeparateGroups) {
+  shard_ = CreateParamShard(workers_, 1);
+  ASSERT_EQ(shard_.size(), 2u);
+  for (auto& entry : shard_) {
+    ASSERT_EQ(entry.second->num_groups, 1);
+    ASSERT_EQ(entry.second->num_total, 1);
+  }
+}
+
+TEST_F(StubTest, AggregateGroups) {
+  shard_ = CreateParamShard(workers_, 2);
+  ASSERT_EQ(shard_.size(), 1u);
+  ParamEntry* entry = shard_.begin()->second;
+  ASSERT_EQ(entry->num_groups, 2);
+  // servers count the shares of one grp
+  ASSERT_EQ(entry->num_total / entry->num_groups, 1);
+  ASSERT_EQ(entry->num_local / entry->num_groups, 1);
+  ASSERT_EQ(entry->shares.at(0), GrpParam(0));
+  ASSERT_EQ(entry->shares.at(1), GrpParam(1));
+
+  // gradients are averaged over grps into the first share
+  for (int grp = 0; grp < 2; grp++) {
+    float* grad = GrpParam(grp)->mutable_cpu_grad();
+    for (int i = 0; i < 4; i++)
+      grad[i] = (grp + 1) * (i + 1);
+  }
+  ThreadPool pool(2);
+  SumLocalGrads(entry, &pool);
+  const float* sum = GrpParam(0)->mutable_cpu_grad();
+  for (int i = 0; i < 4; i++)
+    ASSERT_FLOAT_EQ(sum[i], 1.5f * (i + 1));
+
+  // responses received by the first share reach the other grp slice by slice
+  float* data = GrpParam(0)->mutable_cpu_data();
+  for (int i = 0; i < 4; i++)
+    data[i] = i + 10.f;
+  float* copy = GrpParam(1)->mutable_cpu_data();
+  for (int i = 0; i < 4; i++)
+    copy[i] = 0.f;
+  GrpParam(1)->set_version(0);
+  FanOutSlice(entry, 1, 5);
+  ASSERT_NE(copy, data);
+  ASSERT_NE(copy[0], data[0]);
+  ASSERT_NE(copy[1], data[1]);
+  ASSERT_FLOAT_EQ(copy[2], data[2]);
+  ASSERT_FLOAT_EQ(copy[3], data[3]);
+  ASSERT_EQ(GrpParam(1)->version(), 5);
+  // a failed parse (version -1) copies values but keeps the version
+  FanOutSlice(entry, 0, -1);
+  ASSERT_FLOAT_EQ(copy[0], data[0]);
+  ASSERT_EQ(GrpParam(1)->version(), 5);
+}
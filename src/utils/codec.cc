@@ -0,0 +1,184 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+#include "utils/codec.h"
+
+#include <glog/logging.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include "utils/factory.h"
+#include "utils/singleton.h"
+
+namespace singa {
+
+GradCodec* GradCodec::Create(const CodecProto& proto) {
+  auto factory = Singleton<Factory<GradCodec>>::Instance();
+  GradCodec* codec = nullptr;
+  if (proto.has_user_type())
+    codec = factory->Create(proto.user_type());
+  else
+    codec = factory->Create(proto.type());
+  codec->Init(proto);
+  return codec;
+}
+
+void GradCodec::Encode(const float* grad, int n, float* residual,
+    std::string* buf) {
+  buf->clear();
+  if (residual == nullptr) {
+    Compress(grad, n, buf);
+    return;
+  }
+  val_.resize(n);
+  for (int i = 0; i < n; i++)
+    val_[i] = grad[i] + residual[i];
+  Compress(val_.data(), n, buf);
+  // keep what the receiver will not see
+  memcpy(residual, val_.data(), n * sizeof(float));
+  Decode(buf->data(), buf->size(), n, -1.f, residual);
+}
+
+/****************************FP16Codec*********************************/
+uint16_t FloatToHalf(float x) {
+  uint32_t f;
+  memcpy(&f, &x, sizeof(f));
+  uint32_t sign = (f >> 16) & 0x8000;
+  uint32_t abs = f & 0x7fffffff;
+  if (abs >= 0x7f800000)  // inf or nan
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  if (abs >= 0x477ff000)  // rounds to a value larger than 65504
+    return sign | 0x7c00;
+  if (abs < 0x33000000)  // rounds to 0
+    return sign;
+  uint32_t h, rem, half;
+  if (abs < 0x38800000) {
+    // subnormal half, i.e., mantissa * 2^-24
+    int shift = 126 - (abs >> 23);
+    uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    h = mantissa >> shift;
+    rem = mantissa & ((1u << shift) - 1);
+    half = 1u << (shift - 1);
+  } else {
+    // re-bias the exponent from 127 to 15
+    h = (abs >> 13) - (112 << 10);
+    rem = abs & 0x1fff;
+    half = 0x1000;
+  }
+  if (rem > half || (rem == half && (h & 1)))
+    h++;
+  return sign | h;
+}
+
+float HalfToFloat(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+  uint32_t f;
+  if (exp == 0) {
+    float x = mantissa * (1.f / (1 << 24));
+    return sign ? -x : x;
+  } else if (exp == 31) {
+    f = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    f = sign | ((exp + 112) << 23) | (mantissa << 13);
+  }
+  float x;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+void FP16Codec::Compress(const float* val, int n, std::string* buf) {
+  buf->resize(n * sizeof(uint16_t));
+  uint16_t* dst = reinterpret_cast<uint16_t*>(&(*buf)[0]);
+  for (int i = 0; i < n; i++)
+    dst[i] = FloatToHalf(val[i]);
+}
+
+void FP16Codec::Decode(const char* data, int nbytes, int n, float alpha,
+    float* dst) {
+  CHECK_EQ(nbytes, n * sizeof(uint16_t));
+  const uint16_t* src = reinterpret_cast<const uint16_t*>(data);
+  for (int i = 0; i < n; i++)
+    dst[i] += alpha * HalfToFloat(src[i]);
+}
+
+/****************************TopKCodec*********************************/
+void TopKCodec::Compress(const float* val, int n, std::string* buf) {
+  int k = std::min(n, std::max(1,
+        static_cast<int>(std::ceil(proto_.topk_ratio() * n))));
+  idx_.resize(n);
+  for (int i = 0; i < n; i++)
+    idx_[i] = i;
+  std::nth_element(idx_.begin(), idx_.begin() + k - 1, idx_.end(),
+      [val](int a, int b) { return std::fabs(val[a]) > std::fabs(val[b]); });
+  // sorted indices make decoding cache friendly
+  std::sort(idx_.begin(), idx_.begin() + k);
+  buf->resize(sizeof(int) + k * (sizeof(int) + sizeof(float)));
+  char* ptr = &(*buf)[0];
+  memcpy(ptr, &k, sizeof(int));
+  int* index = reinterpret_cast<int*>(ptr + sizeof(int));
+  float* value = reinterpret_cast<float*>(index + k);
+  for (int i = 0; i < k; i++) {
+    index[i] = idx_[i];
+    value[i] = val[idx_[i]];
+  }
+}
+
+void TopKCodec::Decode(const char* data, int nbytes, int n, float alpha,
+    float* dst) {
+  int k;
+  memcpy(&k, data, sizeof(int));
+  CHECK_EQ(nbytes, sizeof(int) + k * (sizeof(int) + sizeof(float)));
+  const int* index = reinterpret_cast<const int*>(data + sizeof(int));
+  const float* value = reinterpret_cast<const float*>(index + k);
+  for (int i = 0; i < k; i++) {
+    CHECK_LT(index[i], n);
+    dst[index[i]] += alpha * value[i];
+  }
+}
+
+/****************************SignCodec*********************************/
+void SignCodec::Compress(const float* val, int n, std::string* buf) {
+  buf->assign(sizeof(float) + (n + 7) / 8, 0);
+  char* ptr = &(*buf)[0];
+  uint8_t* bits = reinterpret_cast<uint8_t*>(ptr + sizeof(float));
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += std::fabs(val[i]);
+    if (val[i] >= 0)
+      bits[i >> 3] |= 1 << (i & 7);
+  }
+  float scale = n > 0 ? sum / n : 0.f;
+  memcpy(ptr, &scale, sizeof(float));
+}
+
+void SignCodec::Decode(const char* data, int nbytes, int n, float alpha,
+    float* dst) {
+  CHECK_EQ(nbytes, sizeof(float) + (n + 7) / 8);
+  float scale;
+  memcpy(&scale, data, sizeof(float));
+  scale *= alpha;
+  const uint8_t* bits = reinterpret_cast<const uint8_t*>(data + sizeof(float));
+  for (int i = 0; i < n; i++)
+    dst[i] += (bits[i >> 3] >> (i & 7)) & 1 ? scale : -scale;
+}
+
+}  // namespace singa
@@ -76,7 +76,18 @@
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <algorithm>
 #include <cfloat>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef USE_JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+#ifdef USE_PNG
+#include <png.h>
+#endif
 
 #include <glog/logging.h>
 #include <google/protobuf/io/coded_stream.h>
@@ -526,6 +537,131 @@ void BackwardAvgPooling(const float* top, const int num, const int channels,
   }
 }
 
+void PixelsToFloat(const uint8_t* src, int n, const float* mean, float scale,
+    float bias, float* dst) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 vscale = _mm_set1_ps(scale), vbias = _mm_set1_ps(bias);
+  for (; i + 16 <= n; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    __m128 x[4] = {
+      _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)),
+      _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)),
+      _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)),
+      _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero))
+    };
+    for (int k = 0; k < 4; k++) {
+      if (mean != nullptr)
+        x[k] = _mm_sub_ps(x[k], _mm_loadu_ps(mean + i + 4 * k));
+      _mm_storeu_ps(dst + i + 4 * k,
+          _mm_add_ps(_mm_mul_ps(x[k], vscale), vbias));
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    float x = static_cast<float>(src[i]);
+    if (mean != nullptr)
+      x -= mean[i];
+    dst[i] = x * scale + bias;
+  }
+}
+
+#ifdef USE_JPEG
+struct JpegErrorMgr {
+  jpeg_error_mgr pub;
+  jmp_buf jmp;
+};
+
+static void JpegErrorExit(j_common_ptr cinfo) {
+  longjmp(reinterpret_cast<JpegErrorMgr*>(cinfo->err)->jmp, 1);
+}
+
+bool DecodeJPEG(const string& buf, int channels, vector<uint8_t>* hwc,
+    int* height, int* width) {
+  jpeg_decompress_struct cinfo;
+  JpegErrorMgr jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = JpegErrorExit;
+  if (setjmp(jerr.jmp)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, reinterpret_cast<unsigned char*>(
+        const_cast<char*>(buf.data())), buf.size());
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+  *height = cinfo.output_height;
+  *width = cinfo.output_width;
+  hwc->resize((*height) * (*width) * channels);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = hwc->data() + cinfo.output_scanline * (*width) * channels;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+#endif
+
+#ifdef USE_PNG
+bool DecodePNG(const string& buf, int channels, vector<uint8_t>* hwc,
+    int* height, int* width) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&image, buf.data(), buf.size()))
+    return false;
+  image.format = channels == 1 ? PNG_FORMAT_GRAY : PNG_FORMAT_RGB;
+  *height = image.height;
+  *width = image.width;
+  hwc->resize(PNG_IMAGE_SIZE(image));
+  // png_image_finish_read frees the image on both success and failure
+  return png_image_finish_read(&image, nullptr, hwc->data(), 0, nullptr) != 0;
+}
+#endif
+
+void ResizeImage(const uint8_t* src, int height, int width,
+    int channels, int dst_height, int dst_width, uint8_t* dst) {
+  float hscale = static_cast<float>(height) / dst_height;
+  float wscale = static_cast<float>(width) / dst_width;
+  for (int h = 0; h < dst_height; h++) {
+    float y = std::max(0.0f, (h + 0.5f) * hscale - 0.5f);
+    int y0 = std::min(static_cast<int>(y), height - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    float dy = y - y0;
+    for (int w = 0; w < dst_width; w++) {
+      float x = std::max(0.0f, (w + 0.5f) * wscale - 0.5f);
+      int x0 = std::min(static_cast<int>(x), width - 1);
+      int x1 = std::min(x0 + 1, width - 1);
+      float dx = x - x0;
+      for (int c = 0; c < channels; c++) {
+        float top = src[(y0 * width + x0) * channels + c] * (1 - dx)
+          + src[(y0 * width + x1) * channels + c] * dx;
+        float bottom = src[(y1 * width + x0) * channels + c] * (1 - dx)
+          + src[(y1 * width + x1) * channels + c] * dx;
+        dst[(h * dst_width + w) * channels + c] =
+          static_cast<uint8_t>(top * (1 - dy) + bottom * dy + 0.5f);
+      }
+    }
+  }
+}
+
+void HWCToCHW(const uint8_t* src, int height, int width, int channels,
+    bool bgr, uint8_t* dst) {
+  int area = height * width;
+  for (int c = 0; c < channels; c++) {
+    int srcc = bgr ? channels - 1 - c : c;
+    uint8_t* dstc = dst + c * area;
+    for (int i = 0; i < area; i++)
+      dstc[i] = src[i * channels + srcc];
+  }
+}
+
 void ReadProtoFromTextFile(const char* filename, Message* proto) {
   int fd = open(filename, O_RDONLY);
   CHECK_NE(fd, -1) << "File not found: " << filename;
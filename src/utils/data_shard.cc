@@ -23,9 +23,79 @@
 
 #include <glog/logging.h>
 #include <sys/stat.h>
+#include <cstring>
+#include <functional>
 
 namespace singa {
 
+uint64_t KeyFingerprint(const std::string& key) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool KeySet::Insert(uint64_t fp) {
+  if (fp == 0) fp = 1;
+  if (2 * (size_ + 1) > slots_.size())
+    Grow();
+  size_t mask = slots_.size() - 1;
+  // mix the bits as fingerprints of similar keys may share low bits
+  for (size_t i = (fp * 0x9E3779B97F4A7C15ULL) >> 20 & mask; ;
+       i = (i + 1) & mask) {
+    if (slots_[i] == fp)
+      return false;
+    if (slots_[i] == 0) {
+      slots_[i] = fp;
+      size_++;
+      return true;
+    }
+  }
+}
+
+void KeySet::Grow() {
+  std::vector<uint64_t> slots;
+  slots.swap(slots_);
+  slots_.resize(slots.size() ? 2 * slots.size() : 1024, 0);
+  size_ = 0;
+  for (uint64_t fp : slots)
+    if (fp != 0)
+      Insert(fp);
+}
+
+/**
+ * Scan the complete tuples of a shard file.
+ *
+ * @param path shard file
+ * @param func called on the key of every complete tuple
+ * @return offset (end pos) of the last complete tuple
+ */
+static std::streamoff ScanTuples(const std::string& path,
+    const std::function<void(const std::string&)>& func) {
+  std::ifstream fin(path, std::ios::in | std::ios::binary);
+  if (!fin.is_open()) return 0;
+  std::streamoff last_tuple_offset = 0;
+  std::string key;
+  size_t len;
+  while (true) {
+    fin.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!fin.good()) break;
+    key.resize(len);
+    fin.read(&key[0], len);
+    if (!fin.good()) break;
+    fin.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!fin.good()) break;
+    fin.seekg(len, std::ios_base::cur);
+    if (!fin.good()) break;
+    func(key);
+    last_tuple_offset = fin.tellg();
+  }
+  fin.close();
+  return last_tuple_offset;
+}
+
 DataShard::DataShard(const std::string& folder, int mode)
     : DataShard(folder, mode , 104857600) {}
 
@@ -49,7 +119,7 @@ DataShard::DataShard(const std::string& folder, int mode, int capacity) {
       break;
     }
     case DataShard::kAppend: {
-      int last_tuple = PrepareForAppend(path_);
+      std::streamoff last_tuple = PrepareForAppend(path_);
       fdat_.open(path_, std::ios::binary | std::ios::out | std::ios::in
                  | std::ios::ate);
       CHECK(fdat_.is_open()) << "Cannot create file " << path_;
@@ -96,7 +166,7 @@ bool DataShard::Insert(const std::string& key,
 
 // insert one complete tuple
 bool DataShard::Insert(const std::string& key, const std::string& val) {
-  if (keys_.find(key) != keys_.end() || val.size() == 0)
+  if (val.size() == 0 || !keys_.Insert(KeyFingerprint(key)))
     return false;
   int size = key.size() + val.size() + 2*sizeof(size_t);
   if (bufsize_ + size > capacity_) {
@@ -125,6 +195,21 @@ void DataShard::SeekToFirst() {
   CHECK(fdat_.is_open()) << "Cannot create file " << path_;
 }
 
+bool DataShard::SeekTo(int index) {
+  SeekToFirst();
+  for (int i = 0; i < index; i++) {
+    size_t len;
+    fdat_.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!fdat_.good()) return false;
+    fdat_.seekg(len, std::ios_base::cur);
+    fdat_.read(reinterpret_cast<char*>(&len), sizeof(len));
+    if (!fdat_.good()) return false;
+    fdat_.seekg(len, std::ios_base::cur);
+    if (!fdat_.good()) return false;
+  }
+  return fdat_.peek() != EOF;
+}
+
 void DataShard::Flush() {
   fdat_.write(buf_, bufsize_);
   fdat_.flush();
@@ -168,27 +253,10 @@ int DataShard::Next(std::string *key) {
   return vallen;
 }
 
-int DataShard::PrepareForAppend(const std::string& path) {
-  std::ifstream fin(path, std::ios::in | std::ios::binary);
-  if (!fin.is_open()) return 0;
-  int last_tuple_offset = 0;
-  char buf[256];
-  size_t len;
-  while (true) {
-    fin.read(reinterpret_cast<char*>(&len), sizeof(len));
-    if (!fin.good()) break;
-    fin.read(buf, len);
-    buf[len] = '\0';
-    if (!fin.good()) break;
-    fin.read(reinterpret_cast<char*>(&len), sizeof(len));
-    if (!fin.good()) break;
-    fin.seekg(len, std::ios_base::cur);
-    if (!fin.good()) break;
-    keys_.insert(std::string(buf));
-    last_tuple_offset = fin.tellg();
-  }
-  fin.close();
-  return last_tuple_offset;
+std::streamoff DataShard::PrepareForAppend(const std::string& path) {
+  return ScanTuples(path, [this](const std::string& key) {
+    keys_.Insert(KeyFingerprint(key));
+  });
 }
 
 // if the buf does not have the next complete field, read data from disk
@@ -211,4 +279,119 @@ bool DataShard::PrepareNextField(int size) {
   return true;
 }
 
+/*************** Implementation for DataShardBuilder **********************/
+DataShardBuilder::DataShardBuilder(const std::string& folder, int mode)
+    : DataShardBuilder(folder, mode, 104857600) {}
+
+DataShardBuilder::DataShardBuilder(const std::string& folder, int mode,
+    int capacity) : capacity_(capacity), count_(0) {
+  struct stat sb;
+  if (stat(folder.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
+    LOG(INFO) << "Open shard folder " << folder;
+  } else {
+    LOG(FATAL) << "Cannot open shard folder " << folder;
+  }
+  path_ = folder + "/shard.dat";
+  if (mode == DataShard::kCreate) {
+    fdat_.open(path_, std::ios::binary | std::ios::out | std::ios::trunc);
+    CHECK(fdat_.is_open()) << "Cannot create file " << path_;
+  } else {
+    CHECK_EQ(mode, DataShard::kAppend);
+    std::streamoff last_tuple = ScanTuples(path_,
+        [this](const std::string& key) {
+          uint64_t fp = KeyFingerprint(key);
+          keys_[fp >> 60].Insert(fp);
+        });
+    fdat_.open(path_, std::ios::binary | std::ios::out | std::ios::in
+               | std::ios::ate);
+    CHECK(fdat_.is_open()) << "Cannot create file " << path_;
+    fdat_.seekp(last_tuple);
+  }
+  fill_buf_.reserve(capacity_);
+  write_buf_.reserve(capacity_);
+  writer_ = std::thread(&DataShardBuilder::Write, this);
+}
+
+DataShardBuilder::~DataShardBuilder() {
+  Close();
+}
+
+bool DataShardBuilder::Insert(const std::string& key,
+                              const google::protobuf::Message& val) {
+  std::string str;
+  val.SerializeToString(&str);
+  return Insert(key, str);
+}
+
+bool DataShardBuilder::Insert(const std::string& key, const std::string& val) {
+  if (val.size() == 0)
+    return false;
+  uint64_t fp = KeyFingerprint(key);
+  {
+    // kNumKeyShards = 16 shards indexed by the highest 4 bits
+    std::lock_guard<std::mutex> lock(key_mutex_[fp >> 60]);
+    if (!keys_[fp >> 60].Insert(fp))
+      return false;
+  }
+  size_t size = key.size() + val.size() + 2 * sizeof(size_t);
+  CHECK_LE(size, capacity_) << "Tuple size is larger than capacity "
+    << "Try a larger capacity size";
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(!closed_) << "Insert into a closed shard builder";
+  if (fill_buf_.size() + size > capacity_) {
+    // hand over the full buffer once the writer finishes the previous one
+    free_cv_.wait(lock, [this] { return !writing_; });
+    fill_buf_.swap(write_buf_);
+    writing_ = true;
+    full_cv_.notify_one();
+  }
+  size_t offset = fill_buf_.size();
+  fill_buf_.resize(offset + size);
+  char* buf = fill_buf_.data() + offset;
+  *reinterpret_cast<size_t*>(buf) = key.size();
+  buf += sizeof(size_t);
+  memcpy(buf, key.data(), key.size());
+  buf += key.size();
+  *reinterpret_cast<size_t*>(buf) = val.size();
+  buf += sizeof(size_t);
+  memcpy(buf, val.data(), val.size());
+  count_++;
+  return true;
+}
+
+void DataShardBuilder::Close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (closed_)
+      return;
+    free_cv_.wait(lock, [this] { return !writing_; });
+    if (fill_buf_.size()) {
+      fill_buf_.swap(write_buf_);
+      writing_ = true;
+    }
+    closed_ = true;
+  }
+  full_cv_.notify_one();
+  writer_.join();
+  fdat_.flush();
+  fdat_.close();
+}
+
+void DataShardBuilder::Write() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    full_cv_.wait(lock, [this] { return writing_ || closed_; });
+    if (!writing_)
+      return;
+    // producers only touch fill_buf_ while writing_ is true
+    lock.unlock();
+    fdat_.write(write_buf_.data(), write_buf_.size());
+    CHECK(fdat_.good()) << "Failed to write " << path_;
+    write_buf_.clear();
+    lock.lock();
+    writing_ = false;
+    free_cv_.notify_all();
+  }
+}
+
 }  // namespace singa
@@ -0,0 +1,128 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+
+#include "utils/group_sync.h"
+
+#include <string.h>
+#include <algorithm>
+#include "mshadow/tensor.h"
+#include "utils/factory.h"
+#include "utils/singleton.h"
+
+namespace singa {
+
+using namespace mshadow;
+
+GroupSync* GroupSync::Create(const GroupSyncProto& proto, int ngroups) {
+  auto factory = Singleton<Factory<GroupSync>>::Instance();
+  GroupSync* sync = nullptr;
+  if (proto.has_user_type())
+    sync = factory->Create(proto.user_type());
+  else
+    sync = factory->Create(proto.type());
+  sync->Init(proto, ngroups);
+  return sync;
+}
+
+/****************************DownpourSync******************************/
+void DownpourSync::GenRequest(int n, const float* cur, float* last,
+    float* payload) {
+  Tensor<cpu, 1> diff(payload, Shape1(n));
+  Tensor<cpu, 1> cur_t(const_cast<float*>(cur), Shape1(n));
+  Tensor<cpu, 1> last_t(last, Shape1(n));
+  diff = cur_t - last_t;
+  Copy(last_t, cur_t);
+}
+
+void DownpourSync::Merge(int n, const std::vector<const float*>& payloads,
+    float* master, float* center, const std::vector<float*>& responses) {
+  Tensor<cpu, 1> master_t(master, Shape1(n));
+  for (size_t k = 0; k < payloads.size(); k++) {
+    Tensor<cpu, 1> diff(const_cast<float*>(payloads[k]), Shape1(n));
+    master_t += diff;
+    Tensor<cpu, 1> response(responses[k], Shape1(n));
+    Copy(response, master_t);
+  }
+}
+
+void DownpourSync::ParseResponse(int n, const float* response, float* cur,
+    float* last) {
+  Tensor<cpu, 1> master(const_cast<float*>(response), Shape1(n));
+  Tensor<cpu, 1> cur_t(cur, Shape1(n));
+  Tensor<cpu, 1> last_t(last, Shape1(n));
+  cur_t += master - last_t;  // cur = master + (cur - last)
+  Copy(last_t, cur_t);
+}
+
+/****************************EASGDSync*********************************/
+void EASGDSync::GenRequest(int n, const float* cur, float* last,
+    float* payload) {
+  memcpy(payload, cur, n * sizeof(float));
+  memcpy(last, cur, n * sizeof(float));
+}
+
+void EASGDSync::Merge(int n, const std::vector<const float*>& payloads,
+    float* master, float* center, const std::vector<float*>& responses) {
+  Tensor<cpu, 1> center_t(center, Shape1(n));
+  Tensor<cpu, 1> master_t(master, Shape1(n));
+  TensorContainer<cpu, 1> master_elastic(Shape1(n));
+  float master_alpha = proto_.alpha() / std::max(ngroups_ - 1, 1);
+  for (size_t k = 0; k < payloads.size(); k++) {
+    // response = alpha * (local - center), the center moves by it and the
+    // local copy moves back by it
+    Tensor<cpu, 1> local(const_cast<float*>(payloads[k]), Shape1(n));
+    Tensor<cpu, 1> elastic(responses[k], Shape1(n));
+    elastic = (local - center_t) * proto_.alpha();
+    center_t += elastic;
+    // the master copy is elastic to the center like any other copy
+    master_elastic = (master_t - center_t) * master_alpha;
+    master_t -= master_elastic;
+    center_t += master_elastic;
+  }
+}
+
+void EASGDSync::ParseResponse(int n, const float* response, float* cur,
+    float* last) {
+  Tensor<cpu, 1> elastic(const_cast<float*>(response), Shape1(n));
+  Tensor<cpu, 1> cur_t(cur, Shape1(n));
+  cur_t -= elastic;
+  memcpy(last, cur, n * sizeof(float));
+}
+
+/****************************AvgSync***********************************/
+void AvgSync::GenRequest(int n, const float* cur, float* last,
+    float* payload) {
+  memcpy(payload, cur, n * sizeof(float));
+  memcpy(last, cur, n * sizeof(float));
+}
+
+void AvgSync::Merge(int n, const std::vector<const float*>& payloads,
+    float* master, float* center, const std::vector<float*>& responses) {
+  Tensor<cpu, 1> master_t(master, Shape1(n));
+  for (const float* payload : payloads)
+    master_t += Tensor<cpu, 1>(const_cast<float*>(payload), Shape1(n));
+  master_t *= 1.0f / (payloads.size() + 1);
+  for (float* response : responses)
+    memcpy(response, master, n * sizeof(float));
+}
+
+}  // namespace singa
@@ -22,6 +22,7 @@
 #include "utils/param.h"
 
 #include <glog/logging.h>
+#include <stdio.h>
 #include <cmath>
 #include <random>
 #include <unordered_map>
@@ -171,6 +172,7 @@ void Param::ShareFrom(const Param& other) {
   if (data_ != nullptr)
     CHECK(data_->shape() == other.data_->shape());
   data_ = other.data_;
+  signal_ = other.signal_;
   if (grad_.count() == 0)
     grad_.Reshape(data_->shape());
   slice_start_ = other.slice_start_;
@@ -235,10 +237,23 @@ Msg* Param::GenUpdateMsg(bool copy, int idx) {
   CHECK_LT(idx, num_slices_);
   Msg* msg = new Msg();
   msg->set_type(kUpdate);
-  msg->AddFormatFrame("i", copy);
-  void* ptr = grad_.mutable_cpu_data() + slice_offset_[idx];
-  if (copy) {
-    msg->AddFrame(ptr, slice_size_[idx]*sizeof(float));
+  bool encode = copy && codec_ != nullptr;
+  msg->AddFormatFrame("ii", copy, encode ? codec_->type() : kNoCodec);
+  float* ptr = grad_.mutable_cpu_data() + slice_offset_[idx];
+  if (encode) {
+    float* residual = nullptr;
+    if (codec_->error_feedback()) {
+      if (residual_.count() == 0)
+        residual_.Reshape(grad_.shape());
+      residual = residual_.mutable_cpu_data() + slice_offset_[idx];
+    }
+    std::string buf;
+    codec_->Encode(ptr, slice_size_[idx], residual, &buf);
+    msg->AddFrame(buf.data(), buf.size());
+  } else if (copy) {
+    // copied, as zmq may still read the frame after the worker goes on to
+    // the next step and overwrites the gradient
+    msg->AddFrame(ptr, slice_size_[idx] * sizeof(float));
   } else {
     msg->AddFormatFrame("p", ptr);  // to share values of grad blob
   }
@@ -317,12 +332,18 @@ void Param::ParseUpdateMsgs(const vector<Msg*>& msgs) {
   CHECK_GT(msgs.size(), 0);
   float* server_grad = nullptr;
   vector<float*> worker_grad;
+  vector<Msg*> encoded;
   for (auto* msg : msgs) {
-    int copy;
-    msg->ParseFormatFrame("i", &copy);
+    int copy, codec;
+    msg->ParseFormatFrame("ii", &copy, &codec);
     msg->NextFrame();
     float* ptr = nullptr;
-    if (copy) {
+    if (copy && codec != kNoCodec) {
+      CHECK(codec_ != nullptr && codec == codec_->type())
+        << "unknown gradient codec " << codec;
+      encoded.push_back(msg);
+      continue;
+    } else if (copy) {
       ptr = static_cast<float*>(msg->FrameData());
       CHECK_EQ(size() * sizeof(float), msg->FrameSize());
     } else {
@@ -331,16 +352,28 @@ void Param::ParseUpdateMsgs(const vector<Msg*>& msgs) {
     }
     worker_grad.push_back(ptr);
   }
-  if (server_grad == nullptr)
-    server_grad = worker_grad.at(0);
+  if (server_grad == nullptr) {
+    if (worker_grad.size()) {
+      server_grad = worker_grad.at(0);
+    } else {
+      if (decoded_grad_.count() == 0)
+        decoded_grad_.Reshape(data_->shape());
+      server_grad = decoded_grad_.mutable_cpu_data();
+      memset(server_grad, 0, size() * sizeof(float));
+    }
+  }
+  // gradients from other procs are added straight from the frame buffers
+  auto shape = Shape1(size());
+  Tensor<cpu, 1> sum(server_grad, shape);
   for (float* grad : worker_grad) {
     if (grad != server_grad) {
-      // TODO(wangsh) think about optimize it later?
-      for (int i = 0; i < size(); i++) {
-        server_grad[i] += grad[i];
-      }
+      Tensor<cpu, 1> other(grad, shape);
+      sum += other;
     }
   }
+  for (auto* msg : encoded)
+    codec_->Decode(static_cast<char*>(msg->FrameData()), msg->FrameSize(),
+        size(), 1.f, server_grad);
   grad_.set_cpu_data(server_grad);
 }
 
@@ -354,9 +387,17 @@ const vector<Msg*> Param::GenUpdateResponseMsgs(vector<Msg*>* msgs,
     ptr->FirstFrame();
     ptr->SwapAddr();
     ptr->set_type(kRUpdate);
-    int copy;
-    ptr->ParseFormatFrame("i", &copy);
-    if (copy) {
+    int copy, codec;
+    ptr->ParseFormatFrame("ii", &copy, &codec);
+    if (copy && codec != kNoCodec) {
+      // the compressed frame is too small for the values, reply with a new msg
+      Msg* response = new Msg(ptr->src(), ptr->dst());
+      response->set_type(kRUpdate);
+      response->AddFormatFrame("ii", copy, kNoCodec);
+      response->AddFrame(mutable_cpu_data(), sizeof(float) * size());
+      delete ptr;
+      ptr = response;
+    } else if (copy) {
       ptr->NextFrame();
       CHECK_EQ(ptr->FrameSize(), sizeof(float) * size());
       memcpy(ptr->FrameData(), mutable_cpu_data(), ptr->FrameSize());
@@ -417,4 +458,75 @@ void ParamEntry::AddParam(bool local, Param* p) {
   if (local) shares.push_back(p);
 }
 
+/************************SliceSnapshot***************************/
+//!< magic and format version of server checkpoint files
+static const char kSnapshotMagic[4] = {'S', 'G', 'C', 'K'};
+static const int kSnapshotFormat = 1;
+
+bool WriteSliceSnapshots(const string& path, int step,
+    const vector<SliceSnapshot*>& snapshots) {
+  string tmp = path + ".tmp";
+  FILE* file = fopen(tmp.c_str(), "wb");
+  if (file == nullptr) {
+    LOG(ERROR) << "Cannot open " << tmp << " for checkpoint";
+    return false;
+  }
+  int header[3] = {kSnapshotFormat, step, static_cast<int>(snapshots.size())};
+  bool ok = fwrite(kSnapshotMagic, 1, 4, file) == 4
+    && fwrite(header, sizeof(int), 3, file) == 3;
+  for (auto snapshot : snapshots) {
+    int size = snapshot->data.size();
+    int has_history = snapshot->history.size() == snapshot->data.size();
+    int meta[4] = {snapshot->slice, snapshot->version, size, has_history};
+    ok = ok && fwrite(meta, sizeof(int), 4, file) == 4
+      && fwrite(snapshot->data.data(), sizeof(float), size, file)
+        == size_t(size);
+    if (has_history)
+      ok = ok && fwrite(snapshot->history.data(), sizeof(float), size, file)
+        == size_t(size);
+  }
+  ok = fclose(file) == 0 && ok;
+  if (ok)
+    ok = rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok)
+    LOG(ERROR) << "Failed to write checkpoint " << path;
+  return ok;
+}
+
+bool ReadSliceSnapshots(const string& path, vector<SliceSnapshot*>* snapshots) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    LOG(ERROR) << "Cannot open checkpoint " << path;
+    return false;
+  }
+  char magic[4];
+  int header[3];
+  bool ok = fread(magic, 1, 4, file) == 4
+    && memcmp(magic, kSnapshotMagic, 4) == 0
+    && fread(header, sizeof(int), 3, file) == 3
+    && header[0] == kSnapshotFormat;
+  for (int i = 0; ok && i < header[2]; i++) {
+    int meta[4];
+    ok = fread(meta, sizeof(int), 4, file) == 4 && meta[2] >= 0;
+    if (!ok)
+      break;
+    auto snapshot = new SliceSnapshot();
+    snapshot->slice = meta[0];
+    snapshot->version = meta[1];
+    snapshot->data.resize(meta[2]);
+    ok = fread(snapshot->data.data(), sizeof(float), meta[2], file)
+      == size_t(meta[2]);
+    if (meta[3]) {
+      snapshot->history.resize(meta[2]);
+      ok = ok && fread(snapshot->history.data(), sizeof(float), meta[2], file)
+        == size_t(meta[2]);
+    }
+    snapshots->push_back(snapshot);
+  }
+  fclose(file);
+  if (!ok)
+    LOG(ERROR) << "Corrupted checkpoint " << path;
+  return ok;
+}
+
 }  // namespace singa
@@ -0,0 +1,123 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+
+#include "utils/tensor_shard.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace singa {
+
+TensorShardWriter::TensorShardWriter(const std::string& folder,
+    const std::vector<int>& shape, bool has_label) {
+  std::string path = folder + "/tensor.dat";
+  fdat_.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+  CHECK(fdat_.is_open()) << "Cannot create file " << path;
+  CHECK_GT(shape.size(), 0);
+  CHECK_LE(shape.size(), 8);
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kTensorShardMagic, sizeof(header_.magic));
+  header_.version = kTensorShardVersion;
+  header_.dtype = kTensorFloat;
+  header_.ndim = shape.size();
+  rowsize_ = 1;
+  for (size_t i = 0; i < shape.size(); i++) {
+    header_.shape[i] = shape[i];
+    rowsize_ *= shape[i];
+  }
+  header_.has_label = has_label;
+  header_.nrows = 0;
+  // the header is written again with the final nrows by Close()
+  std::vector<char> head(kTensorShardDataOffset, 0);
+  fdat_.write(head.data(), head.size());
+}
+
+TensorShardWriter::~TensorShardWriter() {
+  Close();
+}
+
+void TensorShardWriter::Append(const float* row, float label) {
+  CHECK(!closed_);
+  fdat_.write(reinterpret_cast<const char*>(row), sizeof(float) * rowsize_);
+  if (header_.has_label)
+    labels_.push_back(label);
+  header_.nrows++;
+}
+
+void TensorShardWriter::Close() {
+  if (closed_)
+    return;
+  fdat_.write(reinterpret_cast<const char*>(labels_.data()),
+      sizeof(float) * labels_.size());
+  fdat_.seekp(0);
+  fdat_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  CHECK(fdat_.good()) << "Failed to write the tensor shard";
+  fdat_.close();
+  closed_ = true;
+}
+
+TensorShard::TensorShard(const std::string& folder) {
+  std::string path = folder + "/tensor.dat";
+  int fd = open(path.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Cannot open file " << path;
+  struct stat sb;
+  CHECK_EQ(fstat(fd, &sb), 0);
+  length_ = sb.st_size;
+  CHECK_GE(length_, kTensorShardDataOffset) << "Invalid tensor shard " << path;
+  // private writable mapping, writes (if any) do not go to the file
+  addr_ = static_cast<char*>(mmap(nullptr, length_, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, fd, 0));
+  close(fd);
+  CHECK(addr_ != MAP_FAILED) << "Cannot mmap file " << path;
+  memcpy(&header_, addr_, sizeof(header_));
+  CHECK_EQ(memcmp(header_.magic, kTensorShardMagic, sizeof(header_.magic)), 0)
+    << "Invalid tensor shard " << path;
+  CHECK_EQ(header_.version, kTensorShardVersion);
+  CHECK_EQ(header_.dtype, kTensorFloat) << "Only float tensors are supported";
+  rowsize_ = 1;
+  for (int i = 0; i < header_.ndim; i++)
+    rowsize_ *= header_.shape[i];
+  size_t rowbytes = sizeof(float) * rowsize_ * header_.nrows;
+  size_t labelbytes = header_.has_label ? sizeof(float) * header_.nrows : 0;
+  CHECK_GE(length_, kTensorShardDataOffset + rowbytes + labelbytes)
+    << "Truncated tensor shard " << path;
+  rows_ = reinterpret_cast<float*>(addr_ + kTensorShardDataOffset);
+  if (header_.has_label)
+    labels_ = reinterpret_cast<float*>(addr_ + kTensorShardDataOffset
+        + rowbytes);
+  madvise(addr_, length_, MADV_SEQUENTIAL);
+}
+
+TensorShard::~TensorShard() {
+  if (addr_ != nullptr)
+    munmap(addr_, length_);
+}
+
+const std::vector<int> TensorShard::shape() const {
+  return std::vector<int>(header_.shape, header_.shape + header_.ndim);
+}
+
+}  // namespace singa
@@ -0,0 +1,91 @@
+/************************************************************
+*
+* Licensed to the Apache Software Foundation (ASF) under one
+* or more contributor license agreements.  See the NOTICE file
+* distributed with this work for additional information
+* regarding copyright ownership.  The ASF licenses this file
+* to you under the Apache License, Version 2.0 (the
+* "License"); you may not use this file except in compliance
+* with the License.  You may obtain a copy of the License at
+* 
+*   http://www.apache.org/licenses/LICENSE-2.0
+* 
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*************************************************************/
+
+
+#include "utils/thread_pool.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+
+namespace singa {
+
+ThreadPool::ThreadPool(int nthreads) : nthreads_(nthreads) {
+  CHECK_GT(nthreads_, 0);
+  for (int i = 1; i < nthreads_; i++)
+    threads_.push_back(std::thread(&ThreadPool::Run, this));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_cv_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+void ThreadPool::Run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty())
+        return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
+
+void ThreadPool::ParallelFor(int n,
+    const std::function<void(int, int, int)>& fn) {
+  int nparts = std::min(nthreads_, n);
+  if (nparts <= 1) {
+    if (n > 0)
+      fn(0, 0, n);
+    return;
+  }
+  int step = (n + nparts - 1) / nparts;
+  // num of ranges that have not finished, guarded by mutex_
+  int pending = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int tid = 1; tid < nparts && tid * step < n; tid++) {
+      int start = tid * step, end = std::min(n, start + step);
+      pending++;
+      tasks_.push([this, &fn, &pending, tid, start, end] {
+        fn(tid, start, end);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending == 0)
+          done_cv_.notify_all();
+      });
+    }
+  }
+  task_cv_.notify_all();
+  fn(0, 0, std::min(n, step));
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [&pending] { return pending == 0; });
+}
+
+}  // namespace singa
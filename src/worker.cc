@@ -52,6 +52,8 @@ void Worker::Setup(int grp_id, int id, const JobProto& conf,
   val_net_ = val_net;
   test_net_ = test_net;
   layer_dealer_ = dealer_ = nullptr;
+  allreduce_ = nullptr;
+  updater_ = nullptr;
 }
 
 Worker::~Worker() {
@@ -59,11 +61,19 @@ Worker::~Worker() {
     delete layer_dealer_;
   if (dealer_)
     delete dealer_;
+  if (allreduce_)
+    delete allreduce_;
+  if (updater_)
+    delete updater_;
 }
 
 void Worker::InitNetParams(const JobProto& job_conf, NeuralNet* net) {
   // for each server grp, its first subscriber worker grp does the param init
-  if (grp_id_ % Cluster::Get()->nworker_groups_per_server_group() == 0) {
+  // in allreduce mode, the first worker grp does it for all grps
+  bool init = allreduce_ == nullptr
+    ? grp_id_ % Cluster::Get()->nworker_groups_per_server_group() == 0
+    : grp_id_ == 0;
+  if (init) {
     // extract params that should be initialized by this worker
     // must gen a name for each param if the user doesn't config it
     std::unordered_map<string, Param*> name2param;
@@ -106,26 +116,50 @@ void Worker::InitNetParams(const JobProto& job_conf, NeuralNet* net) {
       }
 
     // warmup training before put params to servers
-    for (; step_ < job_conf.warmup_steps(); step_++)
+    for (; allreduce_ == nullptr && step_ < job_conf.warmup_steps(); step_++)
       TrainOneBatch(step_, net);
     for (auto layer : net->layers()) {
       if (layer->partition_id() == id_)
         for (auto param : layer->GetParams())
-          if (param->owner() == param->id())
+          if (param->owner() == param->id() && allreduce_ == nullptr) {
             Put(param->version(), param);
+            // servers replace the values by those from their checkpoints
+            if (job_conf.server_checkpoint_path_size())
+              param->set_version(-1);
+          }
+    }
+  }
+  if (allreduce_ != nullptr) {
+    // other grps start from zeros, hence the sum is the values of grp 0
+    if (job_conf.warmup_steps() > 0)
+      LOG(WARNING) << "warmup steps are not run in allreduce mode";
+    for (auto layer : net->layers()) {
+      if (layer->partition_id() == id_) {
+        for (auto param : layer->GetParams()) {
+          if (!init) {
+            memset(param->mutable_cpu_data(), 0, param->size() * sizeof(float));
+            param->set_version(job_conf.step());
+          }
+          allreduce_->Sum(param->mutable_cpu_data(), param->size());
+        }
+      }
     }
+    return;
   }
   // wait owners in the same procs init params, then no get requests sent
   std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  int version = job_conf.warmup_steps();
+  if (job_conf.server_checkpoint_path_size())
+    version = job_conf.step();
   for (auto layer : net->layers()) {
     if (layer->partition_id() == id_)
       for (auto param : layer->GetParams())
-        Get(job_conf.warmup_steps(), param);
+        Get(version, param);
   }
 }
 
-void ConnectStub(int grp, int id, Dealer* dealer, EntityType entity) {
-  dealer->Connect(kInprocRouterEndpoint);
+void ConnectStub(int grp, int id, InprocDealer* dealer, EntityType entity) {
+  CHECK(dealer->Connect(kInprocRouterEndpoint));
   Msg* ping = new Msg(Addr(grp, id, entity), Addr(-1, -1, kStub));
   ping->set_type(kConnect);
   dealer->Send(&ping);
@@ -137,20 +171,43 @@ void Worker::Run() {
   int svr_grp = grp_id_ / cluster->nworker_groups_per_server_group();
   CHECK(cluster->runtime()->JoinSGroup(grp_id_, id_, svr_grp));
   // TODO(wangsh): provide a unique sock id from cluster
-  dealer_ = new Dealer(0);
+  dealer_ = new InprocDealer(0);
   ConnectStub(grp_id_, id_, dealer_, kWorkerParam);
+  if (cluster->allreduce()) {
+    // Params are not shared by grps nor by workers, and all grps train
+    CHECK(!cluster->share_memory()) << "allreduce requires share_memory=false";
+    for (auto layer : train_net_->layers())
+      if (layer->partition_id() == id_)
+        for (auto param : layer->GetParams())
+          CHECK_EQ(param->owner(), param->id()) << "shared Params unsupported";
+    std::vector<int> addrs;
+    for (int grp = 0; grp < cluster->nworker_groups(); grp++)
+      addrs.push_back(Addr(grp, id_, kWorkerParam));
+    allreduce_ = new RingAllreduce(dealer_, grp_id_, addrs);
+    updater_ = Updater::Create(job_conf_.updater());
+  }
   for (auto layer : train_net_->layers()) {
     if (layer->partition_id() == id_) {
       if (typeid(layer) == typeid(BridgeDstLayer)
           || typeid(layer) == typeid(BridgeSrcLayer)) {
         // TODO(wangsh): provide a unique socket id from cluster
-        layer_dealer_ = new Dealer(1);
+        layer_dealer_ = new InprocDealer(1);
         ConnectStub(grp_id_, id_, layer_dealer_, kWorkerLayer);
         break;
       }
     }
   }
 
+  // every (group, worker) reads its own part of the training data if the
+  // data layer is configured to partition the dataset
+  for (auto layer : train_net_->layers()) {
+    auto data = dynamic_cast<DataLayer*>(layer);
+    if (data != nullptr && layer->partition_id() == id_)
+      data->set_data_partition(
+          grp_id_ * layer->num_partitions() + layer->partition_id(),
+          cluster->nworker_groups() * layer->num_partitions());
+  }
+
   step_ = job_conf_.step();
   InitNetParams(job_conf_, train_net_);
   while (!StopNow(step_)) {
@@ -166,7 +223,8 @@ void Worker::Run() {
         TestOneBatch(step, kTest, test_net_);
       Display(kTest, "Test @ step " + std::to_string(step_), test_net_);
     }
-    if (CheckpointNow(step_) && grp_id_ == 0) {
+    // servers checkpoint in the background if server_checkpoint is set
+    if (CheckpointNow(step_) && grp_id_ == 0 && !cluster->server_checkpoint()) {
       CollectAll(step_, train_net_);
       Checkpoint(step_, Cluster::Get()->checkpoint_folder(), train_net_);
       job_conf_.set_step(step_);
@@ -238,6 +296,13 @@ int Worker::Get(int step, Param* param) {
 
 int Worker::Update(int step, Param* param) {
   param->set_local_version(param->version());
+  if (allreduce_ != nullptr) {
+    allreduce_->Sum(param->mutable_cpu_grad(), param->size());
+    updater_->Update(step, param, 1.0f / allreduce_->size());
+    // wakes up Collect()
+    param->set_version(param->version() + 1);
+    return 1;
+  }
   if (dealer_ == nullptr) {
     LOG(ERROR) << "Null dealer in worker (" << grp_id_ << ", " << id_ << ")";
     return 1;
@@ -262,8 +327,11 @@ int Worker::CollectAll(int step, NeuralNet* net) {
 }
 
 int Worker::Collect(int step, Param* param) {
-  while (param->version() <= param->local_version())
-    std::this_thread::sleep_for(std::chrono::milliseconds(kCollectSleepTime));
+  // woken up by the stub once a new version arrives; the timeout is a
+  // re-check interval
+  param->version_signal()->Wait([param]() {
+      return param->version() > param->local_version();
+    }, kCollectSleepTime);
   return 1;
 }
 